@@ -10,6 +10,14 @@ local config = {}
 ---@type number
 config.fps = 60
 
+---The maximum frame rate once no input was received for a second, e.g.
+---while only the caret blinks or a plugin keeps redrawing.
+---Set it to 0 to always use `config.fps`.
+---
+---Defaults to 20.
+---@type number
+config.idle_fps = 20
+
 ---Maximum number of log items that will be stored.
 ---When the number of log items exceed this value, old items will be discarded.
 ---
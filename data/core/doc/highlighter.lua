@@ -7,6 +7,18 @@ local Object = require "core.object"
 
 local Highlighter = Object:extend()
 
+-- Lines keep their tokens packed (see tokenizer.tokenize()), the array of
+-- types and texts is only built for plugins that read `line.tokens`.
+local line_mt = {
+  __index = function(line, key)
+    if key == "tokens" and line.packed_tokens then
+      local tokens = tokenizer.unpack_tokens(line.packed_tokens, line.text)
+      rawset(line, "tokens", tokens)
+      return tokens
+    end
+  end
+}
+
 function Highlighter:__tostring() return "Highlighter" end
 
 function Highlighter:new(doc)
@@ -102,10 +114,16 @@ end
 
 
 function Highlighter:tokenize_line(idx, state, resume)
-  local res = {}
+  local res = setmetatable({}, line_mt)
   res.init_state = state
   res.text = self.doc.lines[idx]
-  res.tokens, res.state, res.resume = tokenizer.tokenize(self.doc.syntax, res.text, state, resume)
+  local tokens
+  tokens, res.state, res.resume = tokenizer.tokenize(self.doc.syntax, res.text, state, resume, true)
+  if type(tokens) == "string" then
+    res.packed_tokens = tokens
+  else
+    res.tokens = tokens
+  end
   return res
 end
 
@@ -124,7 +142,8 @@ end
 
 
 function Highlighter:each_token(idx)
-  return tokenizer.each_token(self:get_line(idx).tokens)
+  local line = self:get_line(idx)
+  return tokenizer.each_token(rawget(line, "tokens") or line.packed_tokens, line.text)
 end
 
 return Highlighter
@@ -15,6 +15,11 @@ function DocView:__tostring() return "DocView" end
 
 DocView.context = "session"
 
+-- number of lines whose glyphs are rasterized in the background when a document is opened
+local PREWARM_LINES = 5000
+-- number of lines handed to the fonts at once, between yields
+local PREWARM_CHUNK_LINES = 250
+
 local function move_to_line_offset(dv, line, col, offset)
   local xo = dv.last_x_offset
   if xo.line ~= line or xo.col ~= col then
@@ -66,8 +71,32 @@ function DocView:new(doc)
   self.ime_selection = { from = 0, size = 0 }
   self.ime_status = false
   self.hovering_gutter = false
+  self.last_draw = {}
   self.v_scrollbar:set_forced_status(config.force_scrollbar_status)
   self.h_scrollbar:set_forced_status(config.force_scrollbar_status)
+  -- the glyphs drawn in the first frame are rasterized right away, the rest of
+  -- the document's glyphs in the background
+  core.add_thread(function()
+    coroutine.yield()
+    -- only for documents, not for views in locked nodes like the command view
+    local node = core.root_view.root_node:get_node_for_view(self)
+    if not node or node.locked then return end
+    local fonts, seen = { self:get_font() }, { [self:get_font()] = true }
+    for _, font in pairs(style.syntax_fonts) do
+      if not seen[font] then
+        seen[font] = true
+        table.insert(fonts, font)
+      end
+    end
+    local lines = self.doc.lines
+    for i = 1, math.min(#lines, PREWARM_LINES), PREWARM_CHUNK_LINES do
+      local text = table.concat(lines, "", i, math.min(#lines, PREWARM_LINES, i + PREWARM_CHUNK_LINES - 1))
+      for _, font in ipairs(fonts) do
+        font:prewarm(text)
+      end
+      coroutine.yield()
+    end
+  end, self)
 end
 
 
@@ -424,8 +453,12 @@ function DocView:update()
   if self == core.active_view and not self.mouse_selecting then
     local T, t0 = config.blink_period, core.blink_start
     local ta, tb = core.blink_timer, system.get_time()
-    if ((tb - t0) % T < T / 2) ~= ((ta - t0) % T < T / 2) then
-      core.redraw = true
+    local visible = (tb - t0) % T < T / 2
+    if visible ~= ((ta - t0) % T < T / 2) and not config.disable_blink and not ime.editing then
+      -- carets drawn as overlays are shown and hidden without a new frame
+      if core.redraw or not renderer.show_overlays(visible, core.window) then
+        core.redraw = true
+      end
     end
     core.blink_timer = tb
   end
@@ -442,23 +475,38 @@ function DocView:draw_line_highlight(x, y)
 end
 
 
+-- tokens are drawn in batches of runs, reusing these tables across lines;
+-- batches are small enough that long lines still stop at the right edge
+local run_fonts, run_texts, run_colors, run_tab = {}, {}, {}, {}
+local max_runs = 64
+
 function DocView:draw_line_text(line, x, y)
   local default_font = self:get_font()
   local tx, ty = x, y + self:get_line_text_y_offset()
-  local last_token = nil
-  local tokens = self.doc.highlighter:get_line(line).tokens
-  local tokens_count = #tokens
-  if string.sub(tokens[tokens_count], -1) == "\n" then
-    last_token = tokens_count - 1
-  end
   local start_tx = tx
-  for tidx, type, text in self.doc.highlighter:each_token(line) do
-    local color = style.syntax[type]
-    local font = style.syntax_fonts[type] or default_font
-    -- do not render newline, fixes issue #1164
-    if tidx == last_token then text = text:sub(1, -2) end
-    tx = renderer.draw_text(font, text, tx, ty, color, {tab_offset = tx - start_tx})
-    if tx > self.position.x + self.size.x then break end
+  local max_x = self.position.x + self.size.x
+  local n = 0
+  for _, type, text in self.doc.highlighter:each_token(line) do
+    n = n + 1
+    run_colors[n] = style.syntax[type]
+    run_fonts[n] = style.syntax_fonts[type] or default_font
+    -- do not render newline, fixes issue #1164; lines only have it at the end
+    if text:byte(-1) == 10 then text = text:sub(1, -2) end
+    run_texts[n] = text
+    if n == max_runs then
+      run_tab.tab_offset = tx - start_tx
+      tx = renderer.draw_text_runs(run_fonts, run_texts, run_colors, tx, ty, max_x, run_tab)
+      n = 0
+      if tx > max_x then break end
+    end
+  end
+  if n > 0 then
+    -- drop what is left of a longer batch
+    for i = n + 1, #run_texts do
+      run_fonts[i], run_texts[i], run_colors[i] = nil, nil, nil
+    end
+    run_tab.tab_offset = tx - start_tx
+    renderer.draw_text_runs(run_fonts, run_texts, run_colors, tx, ty, max_x, run_tab)
   end
   return self:get_line_height()
 end
@@ -466,15 +514,19 @@ end
 
 function DocView:draw_overwrite_caret(x, y, width)
   local lh = self:get_line_height()
-  renderer.draw_rect(x, y + lh - style.caret_width, width, style.caret_width, style.caret)
+  renderer.draw_overlay(x, y + lh - style.caret_width, width, style.caret_width, style.caret)
 end
 
 
 function DocView:draw_caret(x, y)
   local lh = self:get_line_height()
-  renderer.draw_rect(x, y, style.caret_width, lh, style.caret)
+  renderer.draw_overlay(x, y, style.caret_width, lh, style.caret)
 end
 
+-- these carets are drawn even while they blink off, as hidden overlays;
+-- carets drawn by overrides are only drawn while they blink on
+local overlay_carets = { [DocView.draw_caret] = true, [DocView.draw_overwrite_caret] = true }
+
 function DocView:draw_line_body(line, x, y)
   -- draw highlight if any selection ends on this line
   local draw_highlight = false
@@ -561,14 +613,17 @@ function DocView:draw_overlay()
     local minline, maxline = self:get_visible_line_range()
     -- draw caret if it overlaps this line
     local T = config.blink_period
+    local blink_on = config.disable_blink or ime.editing
+      or (core.blink_timer - core.blink_start) % T < T / 2
+    renderer.show_overlays(blink_on)
+    local draw_caret = self.doc.overwrite and self.draw_overwrite_caret or self.draw_caret
     for _, line1, col1, line2, col2 in self.doc:get_selections() do
       if line1 >= minline and line1 <= maxline
       and system.window_has_focus(core.window) then
         if ime.editing then
           self:draw_ime_decoration(line1, col1, line2, col2)
         else
-          if config.disable_blink
-          or (core.blink_timer - core.blink_start) % T < T / 2 then
+          if blink_on or overlay_carets[draw_caret] then
             local x, y = self:get_line_screen_position(line1, col1)
             if self.doc.overwrite then
               self:draw_overwrite_caret(x, y, self:get_font():get_width(self.doc:get_char(line1, col1)))
@@ -582,7 +637,29 @@ function DocView:draw_overlay()
   end
 end
 
+function DocView:draw_scroll()
+  -- lets the renderer move what it drew last time instead of drawing it again
+  local pos, size, last = self.position, self.size, self.last_draw
+  local ox, oy = self:get_content_offset()
+  local gw = self:get_gutter_width()
+  if last.x == pos.x and last.y == pos.y and last.w == size.x and last.h == size.y and last.gw == gw then
+    local dx, dy = ox - last.ox, oy - last.oy
+    if dx == 0 then
+      renderer.scroll_rect(pos.x, pos.y, size.x, size.y, 0, dy)
+    else
+      -- the gutter only follows vertical moves
+      if dy ~= 0 then
+        renderer.scroll_rect(pos.x, pos.y, gw, size.y, 0, dy)
+      end
+      renderer.scroll_rect(pos.x + gw, pos.y, size.x - gw, size.y, dx, dy)
+    end
+  end
+  last.x, last.y, last.w, last.h, last.gw, last.ox, last.oy = pos.x, pos.y, size.x, size.y, gw, ox, oy
+end
+
+
 function DocView:draw()
+  self:draw_scroll()
   self:draw_background(style.background)
   local _, indent_size = self.doc:get_indent_info()
   self:get_font():set_tab_size(indent_size)
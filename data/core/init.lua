@@ -25,6 +25,8 @@ end
 
 
 local function save_session()
+  -- a headless run has no window geometry worth keeping
+  if HEADLESS then return end
   local fp = io.open(USERDIR .. PATHSEP .. "session.lua", "w")
   if fp then
     fp:write("return {recents=", common.serialize(core.recent_projects),
@@ -322,7 +324,7 @@ function core.init()
 
   core.window = renwindow._restore()
   if core.window == nil then
-    core.window = renwindow.create("")
+    core.window = HEADLESS and renwindow.create_offscreen(1280, 800) or renwindow.create("")
   end
   do
     local session = load_session()
@@ -348,7 +350,7 @@ function core.init()
         project_dir_explicit = true
       else
         -- on macOS we can get an argument like "-psn_0_52353" that we just ignore.
-        if not ARGS[i]:match("^-psn") then
+        if not ARGS[i]:match("^-psn") and ARGS[i] ~= "--headless" then
           local file_abs = common.is_absolute_path(arg_filename) and arg_filename or (system.absolute_path(".") .. PATHSEP .. common.normalize_path(arg_filename))
           if file_abs then
             table.insert(files, file_abs)
@@ -422,6 +424,21 @@ function core.init()
   -- Load core and user plugins giving preference to user ones with same name.
   local plugins_success, plugins_refuse_list = core.load_plugins()
 
+  -- Rasterize the printable ASCII glyphs of the fonts in the background,
+  -- after the first frame has rasterized the ones it needed right away.
+  core.add_thread(function()
+    coroutine.yield()
+    local ascii = {}
+    for i = 33, 126 do ascii[#ascii + 1] = string.char(i) end
+    ascii = table.concat(ascii)
+    for _, font in ipairs({ style.font, style.big_font, style.code_font }) do
+      font:prewarm(ascii)
+    end
+    for _, font in pairs(style.syntax_fonts) do
+      font:prewarm(ascii)
+    end
+  end)
+
   do
     local pdir, pname = project_dir_abs:match("(.*)[/\\\\](.*)")
     core.log("Opening project %q from directory %s", pname, pdir)
@@ -1053,52 +1070,35 @@ end)
 
 
 function core.run()
-  local next_step
-  local last_frame_time
   local run_threads_full = 0
   while true do
-    core.frame_start = system.get_time()
+    -- the system frame scheduler decides when to step, see system.frame_due()
+    core.frame_start = system.frame_begin(config.fps, config.idle_fps)
     local time_to_wake, threads_done = run_threads()
     if threads_done then
       run_threads_full = run_threads_full + 1
     end
     local did_redraw = false
     local did_step = false
-    local force_draw = core.redraw and last_frame_time and core.frame_start - last_frame_time > (1 / config.fps)
-    if force_draw or not next_step or system.get_time() >= next_step then
-      if core.step() then
-        did_redraw = true
-        last_frame_time = core.frame_start
-      end
-      next_step = nil
+    if system.frame_due(core.redraw) then
+      did_redraw = core.step()
+      system.frame_end(did_redraw, core.window)
       did_step = true
     end
     if core.restart_request or core.quit_request then break end
 
-    if not did_redraw then
-      if system.window_has_focus(core.window) or not did_step or run_threads_full < 2 then
-        local now = system.get_time()
-        if not next_step then -- compute the time until the next blink
-          local t = now - core.blink_start
-          local h = config.blink_period / 2
-          local dt = math.ceil(t / h) * h - t
-          local cursor_time_to_wake = dt + 1 / config.fps
-          next_step = now + cursor_time_to_wake
-        end
-        if system.wait_event(math.min(next_step - now, time_to_wake)) then
-          next_step = nil -- if we've recevied an event, perform a step
-        end
-      else
-        system.wait_event()
-        next_step = nil -- perform a step when we're not in focus if get we an event
-      end
-    else -- if we redrew, then make sure we only draw at most FPS/sec
+    if did_redraw then
       run_threads_full = 0
+      system.frame_wait(core.redraw, time_to_wake)
+    elseif system.window_has_focus(core.window) or not did_step or run_threads_full < 2 then
+      -- step again right after the caret blinks
       local now = system.get_time()
-      local elapsed = now - core.frame_start
-      local next_frame = math.max(0, 1 / config.fps - elapsed)
-      next_step = next_step or (now + next_frame)
-      system.sleep(math.min(next_frame, time_to_wake))
+      local t = now - core.blink_start
+      local h = config.blink_period / 2
+      local next_blink = now + math.ceil(t / h) * h - t + 1 / config.fps
+      system.frame_wait(core.redraw, time_to_wake, next_blink)
+    else
+      system.frame_wait(false) -- perform a step when we're not in focus if get we an event
     end
   end
 end
@@ -46,6 +46,7 @@ function LogView:new()
   self.expanding = {}
   self.scrollable = true
   self.yoffset = 0
+  self.expand_version = 0
 
   core.status_view:show_message("i", style.text, "ctrl+click to copy entry")
 end
@@ -66,6 +67,7 @@ function LogView:expand_item(item)
   item = get_item_height(item)
   item.target = item.target == item.expanded and item.normal or item.expanded
   table.insert(self.expanding, item)
+  self.expand_version = self.expand_version + 1
 end
 
 
@@ -167,7 +169,7 @@ end
 
 -- this is just to get a date string that's consistent
 local datestr = os.date()
-function LogView:draw()
+local function draw_items(self)
   self:draw_background(style.background)
 
   local th = style.font:get_height()
@@ -220,6 +222,27 @@ function LogView:draw()
       core.pop_clip_rect()
     end
   end
+end
+
+
+function LogView:draw()
+  if self.expanding[1] then
+    draw_items(self)
+  else
+    -- the log only changes when an item is added or expanded, so it's
+    -- recorded once and replayed until then
+    local ox, oy = self:get_content_offset()
+    local info, warn, err = style.log.INFO, style.log.WARN, style.log.ERROR
+    self:draw_retained(draw_items,
+      #core.log_items, core.log_items[#core.log_items],
+      self.position.x, self.position.y, self.size.x, self.size.y,
+      ox, oy, self.yoffset, self.expand_version,
+      style.background, style.text, style.dim, style.font, style.icon_font,
+      -- fonts are resized in place by font:set_size()
+      style.font:get_size(), style.icon_font:get_size(),
+      style.padding.x, style.padding.y,
+      info.color, info.icon, warn.color, warn.icon, err.color, err.icon)
+  end
   LogView.super.draw_scrollbar(self)
 end
 
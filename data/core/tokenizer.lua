@@ -5,6 +5,13 @@ local config = require "core.config"
 local tokenizer = {}
 local bad_patterns = {}
 
+-- Packed tokens are a string with, for each token, the byte offset where it
+-- ends and the id of its type. Ids are given in order of appearance and are
+-- kept in `types` in both directions: types[id] = type and types[type] = id.
+local packed_format = "<I4I2"
+local packed_size = string.packsize(packed_format)
+local types = {}
+
 local function push_token(t, type, text)
   if not text or #text == 0 then return end
   type = type or "normal"
@@ -128,17 +135,58 @@ local function report_bad_pattern(log_fn, syntax, pattern_idx, msg, ...)
             syntax.name or "unnamed", ...)
 end
 
+---Pack an array of alternating token types and texts into a string.
+---@param t table
+---@return string? @nil if a token type is not a string
+function tokenizer.pack_tokens(t)
+  local packed, offset = {}, 0
+  for i = 1, #t, 2 do
+    local token_type = t[i]
+    if type(token_type) ~= "string" then return nil end
+    local id = types[token_type]
+    if not id then
+      id = #types + 1
+      if id > 0xffff then return nil end
+      types[id], types[token_type] = token_type, id
+    end
+    offset = offset + #t[i+1]
+    packed[#packed + 1] = string.pack(packed_format, offset, id)
+  end
+  return table.concat(packed)
+end
+
+---Expand packed tokens into an array of alternating token types and texts.
+---@param packed string
+---@param text string @The text that was tokenized
+---@return table
+function tokenizer.unpack_tokens(packed, text)
+  local t, start = {}, 1
+  for pos = 1, #packed, packed_size do
+    local fin, id = string.unpack(packed_format, packed, pos)
+    t[#t + 1] = types[id]
+    t[#t + 1] = text:sub(start, fin)
+    start = fin + 1
+  end
+  return t
+end
+
 ---@param incoming_syntax table
 ---@param text string
 ---@param state string
-function tokenizer.tokenize(incoming_syntax, text, state, resume)
+---@param resume? table
+---@param packed? boolean @Return completed lines as packed tokens.
+---@return table|string @Token types and texts, packed if requested and possible
+---@return string @The state at the end of the line
+---@return table? @Progress to resume from, if the line is incomplete
+function tokenizer.tokenize(incoming_syntax, text, state, resume, packed)
   local res
   local i = 1
 
   state = state or string.char(0)
 
   if #incoming_syntax.patterns == 0 then
-    return { "normal", text }, state
+    res = { "normal", text }
+    return packed and tokenizer.pack_tokens(res) or res, state
   end
 
   if resume then
@@ -154,6 +202,29 @@ function tokenizer.tokenize(incoming_syntax, text, state, resume)
 
   res = res or {}
 
+  -- The native tokenizer produces the same tokens; it returns nil for the
+  -- lines it leaves to the Lua implementation below, like the ones where a
+  -- malformed pattern has to be reported.
+  if native_tokenizer then
+    local native_res, native_state, native_i = native_tokenizer.tokenize(
+      incoming_syntax, text, state, syntax.get, 0.5 / config.fps, res, i,
+      packed and types or nil
+    )
+    if native_res then
+      if native_i then
+        return native_res, string.char(0), {
+          res = native_res,
+          i = native_i,
+          state = native_state
+        }
+      end
+      if packed and type(native_res) == "table" then
+        native_res = tokenizer.pack_tokens(native_res) or native_res
+      end
+      return native_res, native_state
+    end
+  end
+
   -- incoming_syntax    : the parent syntax of the file.
   -- state              : a string of bytes representing syntax state (see above)
 
@@ -394,7 +465,7 @@ function tokenizer.tokenize(incoming_syntax, text, state, resume)
     end
   end
 
-  return res, state
+  return packed and tokenizer.pack_tokens(res) or res, state
 end
 
 
@@ -406,7 +477,22 @@ local function iter(t, i)
   end
 end
 
-function tokenizer.each_token(t)
+---Iterate over tokens, yielding their index, type and text.
+---Packed tokens are sliced from the tokenized text as they are reached.
+---@param t table|string
+---@param text? string @The tokenized text, required for packed tokens
+function tokenizer.each_token(t, text)
+  if type(t) == "string" then
+    local pos, start, i = 1, 1, -1
+    return function()
+      if pos > #t then return end
+      local fin, id
+      fin, id, pos = string.unpack(packed_format, t, pos)
+      local s = start
+      start, i = fin + 1, i + 2
+      return i, types[id], text:sub(s, fin)
+    end
+  end
   return iter, t, -1
 end
 
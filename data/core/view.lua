@@ -331,6 +331,28 @@ function View:draw_scrollbar()
 end
 
 
+---Draws the view with `draw(self)` through a display list that is only
+---recorded again when any of the given values changed since the last call.
+---The values must cover everything the drawing depends on.
+---@param draw fun(self: core.view)
+---@param ... any
+function View:draw_retained(draw, ...)
+  local key, last = table.pack(...), self.retained_key
+  local changed = not last or last.n ~= key.n
+  for i = 1, key.n do
+    if changed then break end
+    changed = key[i] ~= last[i]
+  end
+  if changed then
+    renderer.begin_list(self)
+    draw(self)
+    renderer.end_list()
+    self.retained_key = key
+  end
+  renderer.draw_list(self)
+end
+
+
 function View:draw()
 end
 
@@ -13,6 +13,10 @@ ARCH = "Architecture-OperatingSystem"
 ---@type string | "Windows" | "Mac OS X" | "Linux" | "iOS" | "Android"
 PLATFORM = "Operating System"
 
+---True when lite was started with --headless, drawing to an offscreen window.
+---@type boolean
+HEADLESS = false
+
 ---The current text or ui scale.
 ---@type number
 SCALE = 1.0
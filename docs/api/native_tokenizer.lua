@@ -0,0 +1,38 @@
+---@meta
+
+---
+---Native implementation of the syntax tokenizer used by core.tokenizer.
+---Each syntax table is compiled once into an internal program that is
+---cached until the syntax patterns table is replaced or resized.
+---@class native_tokenizer
+native_tokenizer = {}
+
+---
+---Tokenizes a line of text like core.tokenizer.tokenize().
+---
+---Returns nil, leaving `res` untouched, for the lines that must be handled
+---by the Lua tokenizer: invalid UTF-8 text, malformed patterns that have
+---to be reported and results that depend on how the Lua tokenizer converts
+---regex offsets into character positions.
+---
+---@param syntax table The syntax of the file, as given to syntax.add().
+---@param text string The line to tokenize.
+---@param state? string The state of the previous line.
+---@param get_syntax fun(name:string):table Resolves subsyntax names, eg: syntax.get
+---@param max_time? number Seconds after which the line is left incomplete.
+---@param res? table Tokens to continue from when resuming a line.
+---@param i? integer Character position to continue from when resuming a line.
+---@param types? table Token type ids, as `types[id] = type` and `types[type] = id`.
+---If given, a line that is not resumed is returned packed into a string with
+---6 bytes per token: the byte offset where the token ends and its type id,
+---as in string.pack("<I4I2"). New types are added to the table.
+---
+---@return table|string? res Array of alternating token types and texts, or
+---the packed tokens.
+---@return string? state The state at the end of the line.
+---@return integer? i If the time ran out, the position to resume from; the
+---last token is then the "incomplete" rest of the line.
+function native_tokenizer.tokenize(syntax, text, state, get_syntax, max_time, res, i, types) end
+
+
+return native_tokenizer
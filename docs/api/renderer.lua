@@ -26,6 +26,31 @@ renderer = {}
 ---@field public smoothing boolean
 ---@field public strikethrough boolean
 
+---
+---Statistics about the last frame drawn to a window.
+---@class renderer.stats
+---@field public commands integer Drawing commands issued, including those recorded into display lists.
+---@field public command_bytes integer Memory taken by those commands.
+---@field public dirty_cells integer Cells of the screen that changed since the previous frame.
+---@field public rects integer Rectangles presented, after merging the dirty cells.
+---@field public pixels integer Pixels redrawn.
+---@field public glyphs integer Glyphs drawn.
+---@field public glyph_misses integer Glyph lookups that weren't cached and went through FreeType.
+---@field public rasterizations integer Glyph bitmaps rendered by FreeType.
+---@field public hash_time number Seconds spent finding what changed.
+---@field public draw_time number Seconds spent redrawing it, rasterizing glyphs included.
+---@field public present_time number Seconds spent presenting it to the window.
+
+---
+---Memory used by the glyph cache of a font, summed over the fonts of a group.
+---@class renderer.fontcachestats
+---@field public bytes integer Memory tracked against the budget.
+---@field public budget integer The budget, 0 if unlimited.
+---@field public atlas_bytes integer Pixel memory of the glyph atlases.
+---@field public used_bytes integer Part of it holding glyphs.
+---@field public surfaces integer Number of atlas surfaces.
+---@field public evictions integer Atlas surfaces cleared to stay within the budget.
+
 ---
 ---@class renderer.font
 renderer.font = {}
@@ -74,6 +99,30 @@ function renderer.font:set_tab_size(chars) end
 ---@return number
 function renderer.font:get_width(text) end
 
+---
+---Rasterize the glyphs of the given text in the background, so that drawing
+---them for the first time doesn't stall a frame. Glyphs that are drawn before
+---they're ready are rasterized right away, as if they were never queued.
+---
+---@param text string
+---
+---@return integer queued Number of glyphs that weren't rasterized yet.
+function renderer.font:prewarm(text) end
+
+---
+---Set how much memory the glyph cache of the font (or of every font of a
+---group) may use. Past it, the least recently used atlas surfaces are
+---reused, and their glyphs rasterized again when needed. Defaults to 32MB.
+---
+---@param bytes integer 0 for no limit.
+function renderer.font:set_cache_budget(bytes) end
+
+---
+---Get the memory used by the glyph cache of the font.
+---
+---@return renderer.fontcachestats
+function renderer.font:get_cache_stats() end
+
 ---
 ---Get the height in pixels that occupies a single character
 ---when rendered with this font.
@@ -107,6 +156,33 @@ function renderer.font:get_path() end
 ---@param enable boolean
 function renderer.show_debug(enable) end
 
+---
+---Sets the size in pixels of the cells the screen is divided into to detect
+---changed regions. Smaller cells redraw less on small changes at the cost of
+---more bookkeeping. Passing nil or 0 restores the default of 96.
+---
+---@param size? integer
+function renderer.set_cell_size(size) end
+
+---
+---Sets the directory where the rasterized glyphs of fonts are saved when they
+---are freed, to be mapped in memory the next time they are loaded with the
+---same size and options. Only fonts loaded afterwards are affected, and
+---passing nil disables the cache. Files are written in the background, and
+---the directory is kept under 64 MB by removing the least recently used ones.
+---
+---@param dir? string
+function renderer.set_glyph_cache_dir(dir) end
+
+---
+---Gets the statistics of the last frame drawn to `window`, or to the window
+---being drawn to when omitted.
+---
+---@param window? renwindow
+---
+---@return renderer.stats
+function renderer.get_stats(window) end
+
 ---
 ---Get the size of the screen area been rendered.
 ---
@@ -134,6 +210,52 @@ function renderer.end_frame() end
 ---@param height number
 function renderer.set_clip_rect(x, y, width, height) end
 
+---
+---Declare that what was drawn in a region of the screen on the previous frame
+---moves by dx, dy pixels on the current one, as when a view scrolls.
+---The pixels already on screen are moved instead of being drawn again, and
+---only what doesn't match the moved content is redrawn, so a wrong
+---declaration costs time but never shows wrong content.
+---Only the first of overlapping regions is taken into account.
+---
+---@param x number
+---@param y number
+---@param width number
+---@param height number
+---@param dx integer
+---@param dy integer
+function renderer.scroll_rect(x, y, width, height, dx, dy) end
+
+---
+---Starts recording the drawing commands that follow into the display list
+---named `name`, replacing what it held, until `renderer.end_list` is called.
+---Recorded commands aren't drawn; use `renderer.draw_list` for that.
+---A list named by a table or userdata is freed when its name is collected,
+---any other name keeps it until `renderer.free_list`.
+---
+---@param name any
+function renderer.begin_list(name) end
+
+---
+---Ends the recording started by `renderer.begin_list`.
+function renderer.end_list() end
+
+---
+---Draws the display list named `name` as if its commands were issued again,
+---clipped by the current clip rectangle. Unchanged lists only cost the
+---drawing of the parts of the screen that need a redraw anyway.
+---
+---@param name any
+---
+---@return boolean drawn false if there is no such list
+function renderer.draw_list(name) end
+
+---
+---Frees the display list named `name`.
+---
+---@param name any
+function renderer.free_list(name) end
+
 ---
 ---Draw a rectangle.
 ---
@@ -144,6 +266,29 @@ function renderer.set_clip_rect(x, y, width, height) end
 ---@param color renderer.color
 function renderer.draw_rect(x, y, width, height, color) end
 
+---
+---Draw a rectangle that is only visible while the overlays are shown,
+---e.g. a caret. Unlike other drawing, showing and hiding overlays with
+---renderer.show_overlays() doesn't need a new frame.
+---
+---@param x number
+---@param y number
+---@param width number
+---@param height number
+---@param color renderer.color
+function renderer.draw_overlay(x, y, width, height, color) end
+
+---
+---Show or hide the overlays. During a frame, this applies to the
+---overlays drawn in it. Otherwise those of the last frame of `window`
+---are repainted right away, with the rest of the frame left as it was.
+---
+---@param visible boolean
+---@param window? renwindow Defaults to the window of the current frame.
+---
+---@return boolean shown False if the last frame had no overlays.
+function renderer.show_overlays(visible, window) end
+
 ---
 ---Draw text and return the x coordinate where the text finished drawing.
 ---
@@ -156,5 +301,21 @@ function renderer.draw_rect(x, y, width, height, color) end
 ---@return number x
 function renderer.draw_text(font, text, x, y, color) end
 
+---
+---Draw runs of text one after the other, e.g. the tokens of a line, and
+---return the x coordinate where the last drawn run finished.
+---Runs are no longer drawn once one ends after `max_x`.
+---
+---@param fonts renderer.font[] font of each run
+---@param texts string[]
+---@param colors renderer.color[] color of each run
+---@param x number
+---@param y number
+---@param max_x? number
+---@param tab? {tab_offset: number} tab offset of the first run, defaults to 0
+---
+---@return number x
+function renderer.draw_text_runs(fonts, texts, colors, x, y, max_x, tab) end
+
 
 return renderer
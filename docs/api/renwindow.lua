@@ -18,6 +18,17 @@ renwindow = {}
 ---@return renwindow
 function renwindow.create(x, y, width, height) end
 
+---
+---Create a window that is only drawn in memory, without needing a display.
+---It can be drawn to like any other window and read back with get_pixels.
+---
+---@param width integer in points
+---@param height integer in points
+---@param scale? integer pixels per point, 1 by default
+---
+---@return renwindow
+function renwindow.create_offscreen(width, height, scale) end
+
 ---
 --- Get width and height of a window 
 ---
@@ -26,3 +37,13 @@ function renwindow.create(x, y, width, height) end
 ---@return number width
 ---@return number height
 function renwindow.get_size(window) end
+
+---
+---Get the pixels of the window as they were last drawn.
+---
+---@param window renwindow
+---
+---@return string pixels rows of RGBA bytes, from the top
+---@return integer width in pixels
+---@return integer height in pixels
+function renwindow.get_pixels(window) end
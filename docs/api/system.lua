@@ -313,6 +313,59 @@ function system.get_time() end
 ---@param seconds number Also supports fractions of a second, eg: 0.01
 function system.sleep(seconds) end
 
+---
+---Start an iteration of the main loop, for the frame scheduler.
+---
+---The scheduler paces steps at `fps`, lowered when frames take longer
+---than that to draw, and at `idle_fps` once no event was received for
+---a second. Redraws requested and events received in between are
+---coalesced into the next frame.
+---
+---@param fps? number Target frame rate, defaults to the previous one or 60.
+---@param idle_fps? number Frame rate when idle, 0 to disable.
+---
+---@return number time The start of the iteration, as in system.get_time().
+function system.frame_begin(fps, idle_fps) end
+
+---
+---Whether the main loop should step now.
+---
+---@param redraw? boolean A redraw was requested.
+---
+---@return boolean
+function system.frame_due(redraw) end
+
+---
+---End a step, measuring how long it took to draw when it redrew.
+---
+---@param redrew boolean
+---@param window? renwindow Window drawn to, whose draw and present times are measured.
+function system.frame_end(redrew, window) end
+
+---
+---Wait until the next step is due: after a redraw, until the next frame,
+---otherwise until an event is received, `wake_at` or the next frame if
+---a redraw is requested.
+---
+---@param redraw? boolean A redraw was requested.
+---@param max_wait? number Maximum amount of seconds to wait.
+---@param wake_at? number Time to step at, as in system.get_time().
+function system.frame_wait(redraw, max_wait, wake_at) end
+
+---@class system.frame_stats
+---@field public step_time number Seconds spent outside of drawing by steps that redrew.
+---@field public draw_time number Seconds spent drawing.
+---@field public present_time number Seconds spent presenting.
+---@field public frame_time number Seconds taken by the steps that redrew.
+---@field public interval number Seconds between frames.
+---@field public idle boolean Whether frames are paced at the idle rate.
+
+---
+---Get the smoothed timings of the frame scheduler.
+---
+---@return system.frame_stats
+function system.get_frame_stats() end
+
 ---
 ---Similar to os.execute() but does not return the exit status of the
 ---executed command and executes the process in a non blocking way by
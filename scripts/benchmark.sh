@@ -0,0 +1,76 @@
+#!/bin/bash
+set -e
+
+if [ ! -e "src/api/api.h" ]; then
+  echo "Please run this script from the root directory of Lite XL."; exit 1
+fi
+
+show_help() {
+  echo
+  echo "Usage: $0 <OPTIONS> BENCHMARK"
+  echo
+  echo "Draws frames with the renderer of a Lite XL build, without a display,"
+  echo "and reports the timings of renderer.end_frame() and renderer.get_stats()."
+  echo "BENCHMARK is the name of a file in scripts/benchmark, without extension."
+  echo
+  echo "Available options:"
+  echo
+  echo "-e --executable PATH          Lite XL executable to run, with its data directory."
+  echo "                              Default: 'lite-xl'."
+  echo "-f --frames N                 Number of frames measured. Default: 200."
+  echo "-s --size WIDTHxHEIGHT        Size of the window. Default: 1920x1080."
+  echo "-h --help                     Show this help and exit."
+  echo
+}
+
+main() {
+  local executable="lite-xl"
+  local frames=200
+  local size="1920x1080"
+  local benchmark
+
+  while [[ $# -gt 0 ]]; do
+    case $1 in
+      -h|--help)
+        show_help
+        exit 0
+        ;;
+      -e|--executable)
+        executable="$2"
+        shift
+        shift
+        ;;
+      -f|--frames)
+        frames="$2"
+        shift
+        shift
+        ;;
+      -s|--size)
+        size="$2"
+        shift
+        shift
+        ;;
+      *)
+        benchmark="$1"
+        shift
+        ;;
+    esac
+  done
+
+  if [[ -z $benchmark || ! -f "scripts/benchmark/$benchmark.lua" ]]; then
+    show_help
+    exit 1
+  fi
+
+  # the benchmarks are loaded from a throwaway user directory, so that the
+  # user's configuration and glyph caches are left alone
+  local userdir="$(mktemp -d)"
+  trap "rm -rf '$userdir'" EXIT
+  cp -r scripts/benchmark "$userdir/benchmark"
+
+  LITE_USERDIR="$userdir" LITE_XL_RUNTIME="benchmark.$benchmark" \
+  LITE_BENCHMARK_FRAMES="$frames" LITE_BENCHMARK_SIZE="$size" \
+    "$executable" --headless
+}
+
+main "$@"
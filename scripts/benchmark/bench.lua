@@ -0,0 +1,118 @@
+-- Shared part of the rendering benchmarks, run by scripts/benchmark.sh.
+-- A benchmark is loaded instead of core through LITE_XL_RUNTIME, draws its
+-- frames to an offscreen window with the renderer API alone and reports the
+-- time taken by renderer.end_frame() and the timings of renderer.get_stats().
+local bench = {}
+
+local WARMUP_FRAMES = 10
+
+local words = {
+  "local", "function", "return", "end", "if", "then", "else", "self", "core",
+  "config", "style", "=", "==", "(", ")", ",", ".", "renderer.draw_text",
+  "123", "0x7f", "\"string\"", "-- comment", "nil", "true", "for", "in", "do"
+}
+
+---Returns the tokens of line `n` of a made up source file.
+---@param n integer
+---@return string[]
+function bench.line_tokens(n)
+  local tokens = {}
+  local count = 6 + (n * 7) % 11
+  for i = 1, count do
+    tokens[i] = words[(n * 13 + i * 5) % #words + 1]
+  end
+  return tokens
+end
+
+---Draws an editor-like screen: a tree of files on the left, a document full
+---of text and a status bar.
+---@param width integer
+---@param height integer
+---@param fonts { code: renderer.font, ui: renderer.font }
+---@param scroll? integer document lines scrolled
+function bench.draw_editor(width, height, fonts, scroll)
+  scroll = scroll or 0
+  local tree_width, status_height = math.floor(260 * SCALE), fonts.ui:get_height() + math.floor(8 * SCALE)
+  renderer.set_clip_rect(0, 0, width, height)
+  renderer.draw_rect(0, 0, width, height, { 46, 46, 50 })
+  renderer.draw_rect(0, 0, tree_width, height, { 37, 37, 40 })
+  local line_height = math.floor(fonts.ui:get_height() * 1.2)
+  for i = 0, height // line_height do
+    renderer.draw_text(fonts.ui, words[i % #words + 1] .. ".lua", 20 * SCALE, i * line_height, { 160, 160, 165 })
+  end
+  renderer.set_clip_rect(tree_width, 0, width - tree_width, height - status_height)
+  line_height = math.floor(fonts.code:get_height() * 1.2)
+  for i = 0, (height - status_height) // line_height do
+    local n, y = scroll + i + 1, i * line_height
+    local x = renderer.draw_text(fonts.code, tostring(n), tree_width + 10 * SCALE, y, { 120, 120, 125 })
+    x = tree_width + 60 * SCALE
+    for j, token in ipairs(bench.line_tokens(n)) do
+      x = renderer.draw_text(fonts.code, token .. " ", x, y, { 150 + (n * 30 + j * 50) % 105, 200, 160 })
+    end
+  end
+  renderer.set_clip_rect(0, 0, width, height)
+  renderer.draw_rect(0, height - status_height, width, status_height, { 37, 37, 40 })
+  renderer.draw_text(fonts.ui, "line " .. (scroll + 1) .. "  col 1", 10 * SCALE, height - status_height + 4 * SCALE, { 200, 200, 200 })
+end
+
+local function summarize(samples, field)
+  local values = {}
+  for i, stats in ipairs(samples) do values[i] = stats[field] end
+  table.sort(values)
+  local total = 0
+  for _, value in ipairs(values) do total = total + value end
+  return total / #values, values[math.max(1, math.ceil(#values / 2))], values[math.max(1, math.ceil(#values * 0.95))]
+end
+
+---Makes the runtime of a benchmark that calls `draw` to fill each frame.
+---@param name string
+---@param draw fun(frame: integer, width: integer, height: integer, fonts: { code: renderer.font, ui: renderer.font })
+---@return table runtime
+function bench.runtime(name, draw)
+  local runtime = {}
+
+  function runtime.init()
+    assert(HEADLESS, "benchmarks must be started with --headless")
+  end
+
+  function runtime.run()
+    local frames = tonumber(os.getenv("LITE_BENCHMARK_FRAMES")) or 200
+    local width, height = (os.getenv("LITE_BENCHMARK_SIZE") or "1920x1080"):match("^(%d+)x(%d+)$")
+    width, height = tonumber(width), tonumber(height)
+    assert(width and height, "LITE_BENCHMARK_SIZE must be of the form WIDTHxHEIGHT")
+    local window = renwindow.create_offscreen(width, height)
+    local fonts = {
+      code = renderer.font.load(DATADIR .. "/fonts/JetBrainsMono-Regular.ttf", 15 * SCALE),
+      ui = renderer.font.load(DATADIR .. "/fonts/FiraSans-Regular.ttf", 15 * SCALE)
+    }
+    -- the first frames rasterize the glyphs and fill the caches
+    local samples = {}
+    for frame = 1, WARMUP_FRAMES + frames do
+      renderer.begin_frame(window)
+      draw(frame, width, height, fonts)
+      local start = system.get_time()
+      renderer.end_frame()
+      local end_frame = system.get_time() - start
+      if frame > WARMUP_FRAMES then
+        local stats = renderer.get_stats(window)
+        stats.end_frame = end_frame
+        table.insert(samples, stats)
+      end
+    end
+
+    print(string.format("%s: %d frames at %dx%d", name, frames, width, height))
+    print(string.format("  %-14s %10s %10s %10s", "", "mean", "median", "p95"))
+    for _, field in ipairs { "end_frame", "hash_time", "draw_time", "present_time" } do
+      local mean, median, p95 = summarize(samples, field)
+      print(string.format("  %-14s %8.3fms %8.3fms %8.3fms", field, mean * 1e3, median * 1e3, p95 * 1e3))
+    end
+    for _, field in ipairs { "commands", "dirty_cells", "pixels", "glyphs" } do
+      local mean, median, p95 = summarize(samples, field)
+      print(string.format("  %-14s %10.0f %10.0f %10.0f", field, mean, median, p95))
+    end
+  end
+
+  return runtime
+end
+
+return bench
@@ -0,0 +1,8 @@
+-- The same text-dense screen issued every frame, like an editor that redraws
+-- while nothing changes. Nothing is redrawn, so the end of the frame is all
+-- hashing the commands and comparing them with those of the previous frame.
+local bench = require "benchmark.bench"
+
+return bench.runtime("frame_end", function(frame, width, height, fonts)
+  bench.draw_editor(width, height, fonts)
+end)
@@ -0,0 +1,10 @@
+-- Full-screen translucent overlays, e.g. dimming the editor behind a dialog.
+-- Their colours change every frame, so the whole screen is blended again.
+local bench = require "benchmark.bench"
+
+return bench.runtime("overlays", function(frame, width, height, fonts)
+  bench.draw_editor(width, height, fonts)
+  for i = 0, 3 do
+    renderer.draw_rect(0, 0, width, height, { (frame * 7 + i * 60) % 256, 40, 200, 30 + i * 40 })
+  end
+end)
@@ -7,6 +7,7 @@ int luaopen_regex(lua_State *L);
 int luaopen_process(lua_State *L);
 int luaopen_dirmonitor(lua_State* L);
 int luaopen_utf8extra(lua_State* L);
+int luaopen_native_tokenizer(lua_State* L);
 
 static const luaL_Reg libs[] = {
   { "system",     luaopen_system     },
@@ -16,6 +17,7 @@ static const luaL_Reg libs[] = {
   { "process",    luaopen_process    },
   { "dirmonitor", luaopen_dirmonitor },
   { "utf8extra",  luaopen_utf8extra  },
+  { "native_tokenizer", luaopen_native_tokenizer },
   { NULL, NULL }
 };
 
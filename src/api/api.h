@@ -10,9 +10,19 @@
 #define API_TYPE_DIRMONITOR "Dirmonitor"
 #define API_TYPE_NATIVE_PLUGIN "NativePlugin"
 #define API_TYPE_RENWINDOW "RenWindow"
+#define API_TYPE_DISPLAY_LIST "DisplayList"
+#define API_TYPE_TOKENIZER_PROGRAM "TokenizerProgram"
 
 #define API_CONSTANT_DEFINE(L, idx, key, n) (lua_pushnumber(L, n), lua_setfield(L, idx - 1, key))
 
 void api_load_libs(lua_State *L);
 
+/* utf8.c pattern matching, shared with the native tokenizer */
+#define UTF8_PATTERN_MAXRESULTS (2 + 32)
+int utf8_pattern_find(lua_State *L, const char *s, const char *es,
+                      const char *init, const char *p, const char *ep,
+                      int anchor, const char **res);
+int utf8_isblank(const char *s, const char *e);
+ptrdiff_t utf8_validlen(const char *s, const char *e);
+
 #endif
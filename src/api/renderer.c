@@ -11,6 +11,16 @@
 
 // a reference index to a table that stores the fonts
 static int RENDERER_FONT_REF = LUA_NOREF;
+// a reference index to a weak keyed table of the font tables of the last frame
+// of each window, whose commands are replayed by show_overlays
+static int RENDERER_LAST_FONTS_REF = LUA_NOREF;
+// a reference index to the window of the current frame
+static int RENDERER_WINDOW_REF = LUA_NOREF;
+// a reference index to a weak keyed table of display lists by name, each entry
+// holds the list and a table of the fonts it uses
+static int RENDERER_LISTS_REF = LUA_NOREF;
+// a reference index to the fonts table of the list being recorded
+static int RENDERER_RECORDING_REF = LUA_NOREF;
 
 static int font_get_options(
   lua_State *L,
@@ -227,6 +237,43 @@ static int f_font_get_width(lua_State *L) {
   return 1;
 }
 
+static int f_font_prewarm(lua_State *L) {
+  RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
+  size_t len;
+  const char *text = luaL_checklstring(L, 2, &len);
+
+  lua_pushinteger(L, ren_font_group_prewarm(fonts, text, len));
+  return 1;
+}
+
+static int f_font_set_cache_budget(lua_State *L) {
+  RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
+  lua_Integer budget = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, budget >= 0, 2, "budget must not be negative");
+  ren_font_group_set_cache_budget(fonts, (size_t) budget);
+  return 0;
+}
+
+static int f_font_get_cache_stats(lua_State *L) {
+  RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
+  RenGlyphCacheStats stats;
+  ren_font_group_get_cache_stats(fonts, &stats);
+  lua_createtable(L, 0, 6);
+  lua_pushinteger(L, stats.bytes);
+  lua_setfield(L, -2, "bytes");
+  lua_pushinteger(L, stats.budget);
+  lua_setfield(L, -2, "budget");
+  lua_pushinteger(L, stats.atlas_bytes);
+  lua_setfield(L, -2, "atlas_bytes");
+  lua_pushinteger(L, stats.used_bytes);
+  lua_setfield(L, -2, "used_bytes");
+  lua_pushinteger(L, stats.surfaces);
+  lua_setfield(L, -2, "surfaces");
+  lua_pushinteger(L, stats.evictions);
+  lua_setfield(L, -2, "evictions");
+  return 1;
+}
+
 static int f_font_get_height(lua_State *L) {
   RenFont* fonts[FONT_FALLBACK_MAX]; font_retrieve(L, fonts, 1);
   lua_pushnumber(L, ren_font_group_get_height(fonts));
@@ -306,6 +353,51 @@ static int f_show_debug(lua_State *L) {
 }
 
 
+static int f_set_cell_size(lua_State *L) {
+  rencache_set_cell_size(luaL_optinteger(L, 1, 0));
+  rencache_invalidate();
+  return 0;
+}
+
+
+static int f_set_glyph_cache_dir(lua_State *L) {
+  ren_set_glyph_cache_dir(luaL_optstring(L, 1, NULL));
+  return 0;
+}
+
+
+static int f_get_stats(lua_State *L) {
+  RenWindow *window = lua_isnoneornil(L, 1) ? ren_get_target_window()
+    : *(RenWindow**)luaL_checkudata(L, 1, API_TYPE_RENWINDOW);
+  RenCacheStats stats;
+  rencache_get_stats(window, &stats);
+  lua_createtable(L, 0, 11);
+  lua_pushinteger(L, stats.commands);
+  lua_setfield(L, -2, "commands");
+  lua_pushinteger(L, stats.command_bytes);
+  lua_setfield(L, -2, "command_bytes");
+  lua_pushinteger(L, stats.dirty_cells);
+  lua_setfield(L, -2, "dirty_cells");
+  lua_pushinteger(L, stats.rects);
+  lua_setfield(L, -2, "rects");
+  lua_pushinteger(L, stats.pixels);
+  lua_setfield(L, -2, "pixels");
+  lua_pushinteger(L, stats.glyphs);
+  lua_setfield(L, -2, "glyphs");
+  lua_pushinteger(L, stats.glyph_misses);
+  lua_setfield(L, -2, "glyph_misses");
+  lua_pushinteger(L, stats.rasterizations);
+  lua_setfield(L, -2, "rasterizations");
+  lua_pushnumber(L, stats.hash_time);
+  lua_setfield(L, -2, "hash_time");
+  lua_pushnumber(L, stats.draw_time);
+  lua_setfield(L, -2, "draw_time");
+  lua_pushnumber(L, stats.present_time);
+  lua_setfield(L, -2, "present_time");
+  return 1;
+}
+
+
 static int f_get_size(lua_State *L) {
   int w = 0, h = 0;
   RenWindow *window = ren_get_target_window();
@@ -322,6 +414,8 @@ static int f_begin_frame(UNUSED lua_State *L) {
   RenWindow *window = *(RenWindow**)luaL_checkudata(L, 1, API_TYPE_RENWINDOW);
   ren_set_target_window(window);
   rencache_begin_frame(window);
+  lua_pushvalue(L, 1);
+  RENDERER_WINDOW_REF = luaL_ref(L, LUA_REGISTRYINDEX);
   return 0;
 }
 
@@ -330,8 +424,18 @@ static int f_end_frame(UNUSED lua_State *L) {
   RenWindow *window = ren_get_target_window();
   assert(window != NULL);
   rencache_end_frame(window);
+  luaL_unref(L, LUA_REGISTRYINDEX, RENDERER_RECORDING_REF);
+  RENDERER_RECORDING_REF = LUA_NOREF;
   ren_set_target_window(NULL);
-  // clear the font reference table
+  // the fonts stay referenced as long as the commands of this frame are kept
+  lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_LAST_FONTS_REF);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_WINDOW_REF);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_FONT_REF);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  luaL_unref(L, LUA_REGISTRYINDEX, RENDERER_WINDOW_REF);
+  RENDERER_WINDOW_REF = LUA_NOREF;
+  // and a new reference table is used for the next frame
   lua_newtable(L);
   lua_rawseti(L, LUA_REGISTRYINDEX, RENDERER_FONT_REF);
   return 0;
@@ -356,6 +460,19 @@ static int f_set_clip_rect(lua_State *L) {
 }
 
 
+static int f_scroll_rect(lua_State *L) {
+  lua_Number x = luaL_checknumber(L, 1);
+  lua_Number y = luaL_checknumber(L, 2);
+  lua_Number w = luaL_checknumber(L, 3);
+  lua_Number h = luaL_checknumber(L, 4);
+  int dx = luaL_checkinteger(L, 5);
+  int dy = luaL_checkinteger(L, 6);
+  RenRect rect = rect_to_grid(x, y, w, h);
+  rencache_scroll_rect(ren_get_target_window(), rect, dx, dy);
+  return 0;
+}
+
+
 static int f_draw_rect(lua_State *L) {
   lua_Number x = luaL_checknumber(L, 1);
   lua_Number y = luaL_checknumber(L, 2);
@@ -367,21 +484,52 @@ static int f_draw_rect(lua_State *L) {
   return 0;
 }
 
-static int f_draw_text(lua_State *L) {
-  RenFont* fonts[FONT_FALLBACK_MAX];
-  font_retrieve(L, fonts, 1);
+static int f_draw_overlay(lua_State *L) {
+  lua_Number x = luaL_checknumber(L, 1);
+  lua_Number y = luaL_checknumber(L, 2);
+  lua_Number w = luaL_checknumber(L, 3);
+  lua_Number h = luaL_checknumber(L, 4);
+  RenRect rect = rect_to_grid(x, y, w, h);
+  RenColor color = checkcolor(L, 5, 255);
+  rencache_draw_overlay(ren_get_target_window(), rect, color);
+  return 0;
+}
+
+static int f_show_overlays(lua_State *L) {
+  bool visible = lua_toboolean(L, 1);
+  RenWindow *window = lua_isnoneornil(L, 2) ? ren_get_target_window()
+    : *(RenWindow**)luaL_checkudata(L, 2, API_TYPE_RENWINDOW);
+  lua_pushboolean(L, rencache_show_overlays(window, visible));
+  return 1;
+}
 
+// keeps the font at `idx` alive until the end of the frame
+static void reference_font(lua_State *L, int idx) {
   // stores a reference to this font to the reference table
   lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_FONT_REF);
   if (lua_istable(L, -1))
   {
-    lua_pushvalue(L, 1);
+    lua_pushvalue(L, idx);
     lua_pushboolean(L, 1);
     lua_rawset(L, -3);
   } else {
     fprintf(stderr, "warning: failed to reference count fonts\n");
   }
   lua_pop(L, 1);
+  // and to the list being recorded, which uses it on later frames
+  if (RENDERER_RECORDING_REF != LUA_NOREF) {
+    lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_RECORDING_REF);
+    lua_pushvalue(L, idx);
+    lua_pushboolean(L, 1);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+  }
+}
+
+static int f_draw_text(lua_State *L) {
+  RenFont* fonts[FONT_FALLBACK_MAX];
+  font_retrieve(L, fonts, 1);
+  reference_font(L, 1);
 
   size_t len;
   const char *text = luaL_checklstring(L, 2, &len);
@@ -394,15 +542,170 @@ static int f_draw_text(lua_State *L) {
   return 1;
 }
 
+static int f_draw_text_runs(lua_State *L) {
+  static RenTextRun *runs = NULL;
+  static int capacity = 0;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  double x = luaL_checknumber(L, 4);
+  int y = luaL_checknumber(L, 5);
+  double max_x = luaL_optnumber(L, 6, HUGE_VAL);
+  RenTab tab = checktab(L, 7);
+  int count = luaL_len(L, 2);
+  if (count > capacity) {
+    RenTextRun *new_runs = SDL_realloc(runs, sizeof(RenTextRun) * count);
+    if (!new_runs) return luaL_error(L, "unable to allocate %d text runs", count);
+    runs = new_runs;
+    capacity = count;
+  }
+  // consecutive runs mostly share their font and color, which are only checked once
+  lua_settop(L, 7);
+  lua_pushnil(L); // 8: font of the previous run
+  lua_pushnil(L); // 9: color of the previous run
+  for (int i = 0; i < count; i++) {
+    RenTextRun *run = &runs[i];
+    lua_rawgeti(L, 2, i + 1);
+    // the strings stay referenced by `texts` until the runs are pushed
+    if (lua_type(L, -1) != LUA_TSTRING)
+      return luaL_error(L, "bad text for run %d (string expected, got %s)", i + 1, luaL_typename(L, -1));
+    run->text = lua_tolstring(L, -1, &run->len);
+    lua_pop(L, 1);
+    lua_rawgeti(L, 1, i + 1);
+    if (i > 0 && lua_rawequal(L, -1, 8)) {
+      memcpy(run->fonts, runs[i - 1].fonts, sizeof(run->fonts));
+      lua_pop(L, 1);
+    } else {
+      font_retrieve(L, run->fonts, 10);
+      reference_font(L, 10);
+      lua_replace(L, 8);
+    }
+    lua_rawgeti(L, 3, i + 1);
+    if (i > 0 && lua_rawequal(L, -1, 9)) {
+      run->color = runs[i - 1].color;
+      lua_pop(L, 1);
+    } else {
+      run->color = checkcolor(L, 10, 255);
+      lua_replace(L, 9);
+    }
+  }
+  lua_pushnumber(L, rencache_draw_text_runs(ren_get_target_window(), runs, count, x, y, max_x, tab));
+  return 1;
+}
+
+// pushes the entry of a display list by name, or nil
+static int get_list_entry(lua_State *L, int idx) {
+  lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_LISTS_REF);
+  lua_pushvalue(L, idx);
+  int type = lua_rawget(L, -2);
+  lua_remove(L, -2);
+  return type;
+}
+
+
+static int f_begin_list(lua_State *L) {
+  luaL_checkany(L, 1);
+  if (RENDERER_RECORDING_REF != LUA_NOREF)
+    return luaL_error(L, "a display list is already being recorded");
+  RenWindow *window = ren_get_target_window();
+  if (!window)
+    return luaL_error(L, "display lists can only be recorded while drawing a frame");
+  if (get_list_entry(L, 1) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_createtable(L, 2, 0);
+    RenDisplayList **list = lua_newuserdata(L, sizeof(RenDisplayList*));
+    *list = rencache_list_new();
+    if (!*list)
+      return luaL_error(L, "failed to allocate display list");
+    luaL_setmetatable(L, API_TYPE_DISPLAY_LIST);
+    lua_rawseti(L, -2, 1);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_LISTS_REF);
+    lua_pushvalue(L, 1);
+    lua_pushvalue(L, -3);
+    lua_rawset(L, -3);
+    lua_pop(L, 1);
+  }
+  lua_rawgeti(L, -1, 1);
+  RenDisplayList *list = *(RenDisplayList**)lua_touserdata(L, -1);
+  if (!rencache_begin_list(window, list))
+    return luaL_error(L, "failed to record display list");
+  // the fonts of the previous recording aren't needed anymore
+  lua_newtable(L);
+  lua_pushvalue(L, -1);
+  lua_rawseti(L, -4, 2);
+  RENDERER_RECORDING_REF = luaL_ref(L, LUA_REGISTRYINDEX);
+  return 0;
+}
+
+
+static int f_end_list(lua_State *L) {
+  if (RENDERER_RECORDING_REF == LUA_NOREF)
+    return luaL_error(L, "no display list is being recorded");
+  rencache_end_list(ren_get_target_window());
+  luaL_unref(L, LUA_REGISTRYINDEX, RENDERER_RECORDING_REF);
+  RENDERER_RECORDING_REF = LUA_NOREF;
+  return 0;
+}
+
+
+static int f_draw_list(lua_State *L) {
+  luaL_checkany(L, 1);
+  if (RENDERER_RECORDING_REF != LUA_NOREF)
+    return luaL_error(L, "display lists can't be drawn while recording one");
+  if (get_list_entry(L, 1) != LUA_TTABLE) {
+    lua_pushboolean(L, 0);
+    return 1;
+  }
+  // the list and its fonts are kept until the end of the frame
+  lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_FONT_REF);
+  lua_pushvalue(L, -2);
+  lua_pushboolean(L, 1);
+  lua_rawset(L, -3);
+  lua_pop(L, 1);
+  lua_rawgeti(L, -1, 1);
+  rencache_draw_list(ren_get_target_window(), *(RenDisplayList**)lua_touserdata(L, -1));
+  lua_pushboolean(L, 1);
+  return 1;
+}
+
+
+static int f_free_list(lua_State *L) {
+  luaL_checkany(L, 1);
+  lua_rawgeti(L, LUA_REGISTRYINDEX, RENDERER_LISTS_REF);
+  lua_pushvalue(L, 1);
+  lua_pushnil(L);
+  lua_rawset(L, -3);
+  return 0;
+}
+
+
+static int f_list_gc(lua_State *L) {
+  RenDisplayList **self = luaL_checkudata(L, 1, API_TYPE_DISPLAY_LIST);
+  rencache_list_free(*self);
+  return 0;
+}
+
+
 static const luaL_Reg lib[] = {
-  { "show_debug",         f_show_debug         },
-  { "get_size",           f_get_size           },
-  { "begin_frame",        f_begin_frame        },
-  { "end_frame",          f_end_frame          },
-  { "set_clip_rect",      f_set_clip_rect      },
-  { "draw_rect",          f_draw_rect          },
-  { "draw_text",          f_draw_text          },
-  { NULL,                 NULL                 }
+  { "show_debug",          f_show_debug          },
+  { "set_cell_size",       f_set_cell_size       },
+  { "set_glyph_cache_dir", f_set_glyph_cache_dir },
+  { "get_size",            f_get_size            },
+  { "get_stats",           f_get_stats           },
+  { "begin_frame",         f_begin_frame         },
+  { "end_frame",           f_end_frame           },
+  { "set_clip_rect",       f_set_clip_rect       },
+  { "scroll_rect",         f_scroll_rect         },
+  { "draw_rect",           f_draw_rect           },
+  { "draw_overlay",        f_draw_overlay        },
+  { "show_overlays",       f_show_overlays       },
+  { "draw_text",           f_draw_text           },
+  { "draw_text_runs",      f_draw_text_runs      },
+  { "begin_list",          f_begin_list          },
+  { "end_list",            f_end_list            },
+  { "draw_list",           f_draw_list           },
+  { "free_list",           f_free_list           },
+  { NULL,                  NULL                  }
 };
 
 static const luaL_Reg fontLib[] = {
@@ -412,6 +715,9 @@ static const luaL_Reg fontLib[] = {
   { "group",              f_font_group              },
   { "set_tab_size",       f_font_set_tab_size       },
   { "get_width",          f_font_get_width          },
+  { "prewarm",            f_font_prewarm            },
+  { "set_cache_budget",   f_font_set_cache_budget   },
+  { "get_cache_stats",    f_font_get_cache_stats    },
   { "get_height",         f_font_get_height         },
   { "get_size",           f_font_get_size           },
   { "set_size",           f_font_set_size           },
@@ -423,6 +729,24 @@ int luaopen_renderer(lua_State *L) {
   // gets a reference on the registry to store font data
   lua_newtable(L);
   RENDERER_FONT_REF = luaL_ref(L, LUA_REGISTRYINDEX);
+  // closed windows drop the fonts of their last frame
+  lua_newtable(L);
+  lua_createtable(L, 0, 1);
+  lua_pushstring(L, "k");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  RENDERER_LAST_FONTS_REF = luaL_ref(L, LUA_REGISTRYINDEX);
+  // lists named by an object go away along with it
+  lua_newtable(L);
+  lua_createtable(L, 0, 1);
+  lua_pushstring(L, "k");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  RENDERER_LISTS_REF = luaL_ref(L, LUA_REGISTRYINDEX);
+  luaL_newmetatable(L, API_TYPE_DISPLAY_LIST);
+  lua_pushcfunction(L, f_list_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
 
   luaL_newlib(L, lib);
   luaL_newmetatable(L, API_TYPE_FONT);
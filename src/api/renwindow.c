@@ -3,6 +3,7 @@
 #include "lua.h"
 #include <SDL3/SDL.h>
 #include <stdlib.h>
+#include <string.h>
 
 static RenWindow *persistant_window = NULL;
 
@@ -50,6 +51,25 @@ static int f_renwin_create(lua_State *L) {
   return 1;
 }
 
+static int f_renwin_create_offscreen(lua_State *L) {
+  int width = luaL_checkinteger(L, 1);
+  int height = luaL_checkinteger(L, 2);
+  int scale = luaL_optinteger(L, 3, 1);
+  luaL_argcheck(L, width > 0, 1, "width must be positive");
+  luaL_argcheck(L, height > 0, 2, "height must be positive");
+  luaL_argcheck(L, scale > 0, 3, "scale must be positive");
+
+  RenWindow *offscreen = ren_create_offscreen(width, height, scale);
+  if (!offscreen) {
+    return luaL_error(L, "Error creating offscreen window: %s", SDL_GetError());
+  }
+  RenWindow **window_renderer = (RenWindow**)lua_newuserdata(L, sizeof(RenWindow*));
+  luaL_setmetatable(L, API_TYPE_RENWINDOW);
+  *window_renderer = offscreen;
+
+  return 1;
+}
+
 static int f_renwin_gc(lua_State *L) {
   RenWindow *window_renderer = *(RenWindow**)luaL_checkudata(L, 1, API_TYPE_RENWINDOW);
   if (window_renderer != persistant_window)
@@ -67,6 +87,26 @@ static int f_renwin_get_size(lua_State *L) {
   return 2;
 }
 
+static int f_renwin_get_pixels(lua_State *L) {
+  RenWindow *window_renderer = *(RenWindow**)luaL_checkudata(L, 1, API_TYPE_RENWINDOW);
+  SDL_Surface *surface = renwin_get_surface(window_renderer).surface;
+  SDL_Surface *pixels = SDL_ConvertSurface(surface, SDL_PIXELFORMAT_RGBA32);
+  if (!pixels) {
+    return luaL_error(L, "Error reading window pixels: %s", SDL_GetError());
+  }
+  size_t row_size = (size_t) pixels->w * 4;
+  luaL_Buffer b;
+  char *dst = luaL_buffinitsize(L, &b, row_size * pixels->h);
+  for (int y = 0; y < pixels->h; y++) {
+    memcpy(dst + y * row_size, (const char *) pixels->pixels + (size_t) y * pixels->pitch, row_size);
+  }
+  luaL_pushresultsize(&b, row_size * pixels->h);
+  lua_pushinteger(L, pixels->w);
+  lua_pushinteger(L, pixels->h);
+  SDL_DestroySurface(pixels);
+  return 3;
+}
+
 static int f_renwin_persist(lua_State *L) {
   RenWindow *window_renderer = *(RenWindow**)luaL_checkudata(L, 1, API_TYPE_RENWINDOW);
 
@@ -89,11 +129,13 @@ static int f_renwin_restore(lua_State *L) {
 }
 
 static const luaL_Reg renwindow_lib[] = {
-  { "create",     f_renwin_create     },
-  { "__gc",       f_renwin_gc         },
-  { "get_size",   f_renwin_get_size   },
-  { "_persist",   f_renwin_persist    },
-  { "_restore",   f_renwin_restore    },
+  { "create",           f_renwin_create           },
+  { "create_offscreen", f_renwin_create_offscreen },
+  { "__gc",             f_renwin_gc               },
+  { "get_size",         f_renwin_get_size         },
+  { "get_pixels",       f_renwin_get_pixels       },
+  { "_persist",         f_renwin_persist          },
+  { "_restore",         f_renwin_restore          },
   {NULL, NULL}
 };
 
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <math.h>
 #include <errno.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -158,6 +159,37 @@ static void push_win32_error(lua_State *L, DWORD rc) {
 }
 #endif
 
+// Paces the main loop: a step is due once per frame interval, which is the
+// target rate, lowered when drawing takes longer than that and to the idle
+// rate once no event came in for a while. Redraws and events arriving within
+// an interval are coalesced into the next frame.
+#define FRAME_IDLE_DELAY 1.0
+#define FRAME_COST_HEADROOM 1.25
+#define FRAME_SMOOTHING 0.2
+#define FRAME_MAX_COST 2.0 // in frames at the target rate
+
+static struct {
+  double fps, idle_fps;
+  double step_start, last_draw, last_event;
+  double deadline;      // a step was requested for this time, 0 when none
+  bool stepped, drew, event_pending;
+  // smoothed over the frames that drew
+  double cost, step_time, draw_time, present_time;
+} frame = { .fps = 60 };
+
+static double get_time(void) {
+  return SDL_GetPerformanceCounter() / (double) SDL_GetPerformanceFrequency();
+}
+
+static bool frame_is_idle(double now) {
+  return frame.idle_fps > 0 && frame.idle_fps < frame.fps && now - frame.last_event > FRAME_IDLE_DELAY;
+}
+
+static double frame_interval(double now) {
+  double rate = frame_is_idle(now) ? frame.idle_fps : frame.fps;
+  return SDL_max(1.0 / rate, frame.cost * FRAME_COST_HEADROOM);
+}
+
 static int f_poll_event(lua_State *L) {
   char buf[16];
   float mx, my;
@@ -169,6 +201,7 @@ top:
   if ( !SDL_PollEvent(&e) ) {
     return 0;
   }
+  frame.last_event = get_time();
 
   switch (e.type) {
     case SDL_EVENT_QUIT:
@@ -860,8 +893,100 @@ static int f_get_process_id(lua_State *L) {
 
 
 static int f_get_time(lua_State *L) {
-  double n = SDL_GetPerformanceCounter() / (double) SDL_GetPerformanceFrequency();
-  lua_pushnumber(L, n);
+  lua_pushnumber(L, get_time());
+  return 1;
+}
+
+
+static int f_frame_begin(lua_State *L) {
+  frame.fps = luaL_optnumber(L, 1, frame.fps);
+  frame.idle_fps = luaL_optnumber(L, 2, frame.idle_fps);
+  luaL_argcheck(L, frame.fps > 0, 1, "the frame rate must be positive");
+  frame.step_start = get_time();
+  if (!frame.stepped)
+    frame.last_event = frame.step_start;
+  lua_pushnumber(L, frame.step_start);
+  return 1;
+}
+
+
+static int f_frame_due(lua_State *L) {
+  bool redraw = lua_toboolean(L, 1);
+  double now = get_time();
+  bool in_slot = now >= frame.last_draw + frame_interval(now);
+  lua_pushboolean(L, !frame.stepped
+    || (frame.deadline > 0 && now >= frame.deadline)
+    || (frame.event_pending && !frame.drew)
+    || (in_slot && (frame.drew || redraw || frame.event_pending)));
+  return 1;
+}
+
+
+static int f_frame_end(lua_State *L) {
+  bool redrew = lua_toboolean(L, 1);
+  double now = get_time();
+  if (redrew) {
+    RenCacheStats stats = { 0 };
+    if (!lua_isnoneornil(L, 2))
+      rencache_get_stats(*(RenWindow**)luaL_checkudata(L, 2, API_TYPE_RENWINDOW), &stats);
+    double cost = now - frame.step_start;
+    double draw = stats.hash_time + stats.draw_time;
+    double k = frame.last_draw > 0 ? FRAME_SMOOTHING : 1;
+    // a single slow frame (e.g. loading a file) shouldn't slow down those after it
+    frame.cost += k * (SDL_min(cost, FRAME_MAX_COST / frame.fps) - frame.cost);
+    frame.draw_time += k * (draw - frame.draw_time);
+    frame.present_time += k * (stats.present_time - frame.present_time);
+    frame.step_time += k * (SDL_max(cost - draw - stats.present_time, 0) - frame.step_time);
+    frame.last_draw = frame.step_start;
+  }
+  frame.stepped = true;
+  frame.drew = redrew;
+  frame.event_pending = false;
+  frame.deadline = 0;
+  return 0;
+}
+
+
+static int f_frame_wait(lua_State *L) {
+  bool redraw = lua_toboolean(L, 1);
+  double max_wait = luaL_optnumber(L, 2, HUGE_VAL);
+  if (!lua_isnoneornil(L, 3)) {
+    double wake_at = luaL_checknumber(L, 3);
+    frame.deadline = frame.deadline > 0 ? SDL_min(frame.deadline, wake_at) : wake_at;
+  }
+  double now = get_time();
+  double next = frame.deadline > 0 ? frame.deadline : HUGE_VAL;
+  if (frame.drew || redraw)
+    next = SDL_min(next, frame.last_draw + frame_interval(now));
+  double timeout = SDL_max(SDL_min(next - now, max_wait), 0);
+  if (frame.drew) {
+    // events are left for the step of the next frame
+    if (timeout > 0)
+      SDL_Delay(timeout * 1000);
+  } else if (timeout == HUGE_VAL) {
+    frame.event_pending = SDL_WaitEvent(NULL);
+  } else {
+    frame.event_pending = SDL_WaitEventTimeout(NULL, timeout * 1000);
+  }
+  return 0;
+}
+
+
+static int f_get_frame_stats(lua_State *L) {
+  lua_createtable(L, 0, 6);
+  lua_pushnumber(L, frame.step_time);
+  lua_setfield(L, -2, "step_time");
+  lua_pushnumber(L, frame.draw_time);
+  lua_setfield(L, -2, "draw_time");
+  lua_pushnumber(L, frame.present_time);
+  lua_setfield(L, -2, "present_time");
+  lua_pushnumber(L, frame.cost);
+  lua_setfield(L, -2, "frame_time");
+  double now = get_time();
+  lua_pushnumber(L, frame_interval(now));
+  lua_setfield(L, -2, "interval");
+  lua_pushboolean(L, frame_is_idle(now));
+  lua_setfield(L, -2, "idle");
   return 1;
 }
 
@@ -1197,6 +1322,11 @@ static const luaL_Reg lib[] = {
   { "set_primary_selection", f_set_primary_selection },
   { "get_process_id",        f_get_process_id        },
   { "get_time",              f_get_time              },
+  { "frame_begin",           f_frame_begin           },
+  { "frame_due",             f_frame_due             },
+  { "frame_end",             f_frame_end             },
+  { "frame_wait",            f_frame_wait            },
+  { "get_frame_stats",       f_get_frame_stats       },
   { "sleep",                 f_sleep                 },
   { "exec",                  f_exec                  },
   { "fuzzy_match",           f_fuzzy_match           },
@@ -0,0 +1,793 @@
+#include "api.h"
+
+#define PCRE2_CODE_UNIT_WIDTH 8
+
+#include <SDL3/SDL.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pcre2.h>
+
+// Native version of core.tokenizer. A syntax table is compiled once into a
+// TokenProgram (cached per syntax table), which is then run over a line
+// using byte offsets instead of character indexes. Anything the Lua
+// tokenizer would report, or where its result depends on a quirk of the
+// character index conversions, makes tokenize() return nil so that the
+// caller can fall back to the Lua tokenizer for that line.
+//
+// When given a table of token type ids the tokens are packed into a string
+// instead of a table, with PACKED_TOKEN_SIZE bytes per token: the byte
+// offset where the token ends (32 bits) and its type id (16 bits), both
+// little endian, so that no string has to be created for the token texts.
+
+#define MAX_STATE_DEPTH 256
+#define MAX_RESULTS UTF8_PATTERN_MAXRESULTS
+#define PACKED_TOKEN_SIZE 6
+#define PACKED_MAX_TYPE 0xffff
+#define PACKED_MAX_OFFSET 0xffffffff
+
+typedef struct {
+  char *code;
+  size_t len;
+  pcre2_code *re;
+  pcre2_match_data *md;
+  bool whole_line;
+} TokenMatcher;
+
+typedef struct {
+  TokenMatcher match[2];
+  char escape[4];
+  int escape_len;
+  bool pair;
+  bool disabled;
+  int type_ref;
+  int syntax_ref;
+} TokenPattern;
+
+typedef struct {
+  TokenPattern *patterns;
+  int npatterns;
+  int patterns_ref;
+  bool unsupported;
+  bool stale;
+} TokenProgram;
+
+typedef struct {
+  lua_State *L;
+  const char *text;
+  size_t len;
+  int get_syntax, res, types, symbols, pending_type, anchors, buffer;
+  bool has_symbols;
+  lua_Integer ntokens, max_written;
+  unsigned char *packed;
+  size_t packed_len, packed_cap;
+  bool pending, pending_blank;
+  size_t pending_start, pending_end;
+  unsigned char state[MAX_STATE_DEPTH];
+  int state_len;
+  TokenProgram *base, *prog;
+  TokenPattern *info;
+  int pattern_idx, level;
+} Tokenizer;
+
+static const char programs_key = 0;
+
+static bool matcher_compile(lua_State *L, TokenMatcher *m, bool regex, int whole_line) {
+  size_t len;
+  const char *code = lua_tolstring(L, -1, &len);
+  // whole_line is -1 when the Lua tokenizer has not stripped the '^' yet
+  if (whole_line < 0) {
+    whole_line = len > 0 && code[0] == '^';
+    if (whole_line) code++, len--;
+  }
+  m->whole_line = whole_line;
+  m->len = len;
+  m->code = SDL_malloc(len + 1);
+  if (!m->code) return false;
+  memcpy(m->code, code, len);
+  m->code[len] = '\0';
+  if (regex) {
+    int errornumber;
+    PCRE2_SIZE erroroffset;
+    m->re = pcre2_compile((PCRE2_SPTR)m->code, len, PCRE2_UTF, &errornumber, &erroroffset, NULL);
+    if (!m->re) return false;
+    pcre2_jit_compile(m->re, PCRE2_JIT_COMPLETE);
+    m->md = pcre2_match_data_create_from_pattern(m->re, NULL);
+    if (!m->md) return false;
+  }
+  return true;
+}
+
+static int whole_line_flag(lua_State *L, int pattern, int idx) {
+  int flag = -1;
+  if (lua_getfield(L, pattern, "whole_line") == LUA_TTABLE) {
+    if (lua_rawgeti(L, -1, idx) != LUA_TNIL)
+      flag = lua_toboolean(L, -1);
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  return flag;
+}
+
+static bool pattern_compile(lua_State *L, int pattern, TokenPattern *pat) {
+  bool regex = false, ok = true;
+  if (lua_getfield(L, pattern, "pattern") == LUA_TNIL || !lua_toboolean(L, -1)) {
+    lua_pop(L, 1);
+    lua_getfield(L, pattern, "regex");
+    regex = true;
+  }
+  if (lua_type(L, -1) == LUA_TSTRING) {
+    ok = matcher_compile(L, &pat->match[0], regex, whole_line_flag(L, pattern, 1));
+  } else if (lua_type(L, -1) == LUA_TTABLE) {
+    pat->pair = true;
+    for (int i = 0; i < 2 && ok; i++) {
+      ok = lua_rawgeti(L, -1, i + 1) == LUA_TSTRING &&
+        matcher_compile(L, &pat->match[i], regex, whole_line_flag(L, pattern, i + 1));
+      lua_pop(L, 1);
+    }
+    int type = lua_rawgeti(L, -1, 3);
+    if (type == LUA_TSTRING) {
+      size_t len;
+      const unsigned char *escape = (const unsigned char *)lua_tolstring(L, -1, &len);
+      // only the first character is compared, like in the Lua tokenizer
+      int n = len == 0 ? 0 : escape[0] < 0x80 ? 1 : escape[0] < 0xe0 ? 2 : escape[0] < 0xf0 ? 3 : 4;
+      pat->escape_len = n <= (int)len ? n : 0;
+      memcpy(pat->escape, escape, pat->escape_len);
+    } else if (type != LUA_TNIL) {
+      ok = false;
+    }
+    lua_pop(L, 1);
+  } else {
+    ok = false;
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, pattern, "disabled");
+  pat->disabled = lua_toboolean(L, -1);
+  lua_pop(L, 1);
+  lua_getfield(L, pattern, "type");
+  pat->type_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  lua_getfield(L, pattern, "syntax");
+  if (lua_toboolean(L, -1))
+    pat->syntax_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+  else
+    lua_pop(L, 1);
+  return ok;
+}
+
+static void program_free(lua_State *L, TokenProgram *prog) {
+  for (int i = 0; i < prog->npatterns; i++) {
+    TokenPattern *pat = &prog->patterns[i];
+    for (int j = 0; j < 2; j++) {
+      SDL_free(pat->match[j].code);
+      if (pat->match[j].md) pcre2_match_data_free(pat->match[j].md);
+      if (pat->match[j].re) pcre2_code_free(pat->match[j].re);
+    }
+    luaL_unref(L, LUA_REGISTRYINDEX, pat->type_ref);
+    luaL_unref(L, LUA_REGISTRYINDEX, pat->syntax_ref);
+  }
+  luaL_unref(L, LUA_REGISTRYINDEX, prog->patterns_ref);
+  SDL_free(prog->patterns);
+  prog->patterns = NULL;
+  prog->npatterns = 0;
+  prog->patterns_ref = LUA_NOREF;
+}
+
+static int f_program_gc(lua_State *L) {
+  program_free(L, luaL_checkudata(L, 1, API_TYPE_TOKENIZER_PROGRAM));
+  return 0;
+}
+
+// Pushes the compiled program of the syntax table at the given index.
+static TokenProgram *program_compile(lua_State *L, int syntax) {
+  TokenProgram *prog = lua_newuserdatauv(L, sizeof(TokenProgram), 0);
+  memset(prog, 0, sizeof(TokenProgram));
+  prog->patterns_ref = LUA_NOREF;
+  luaL_setmetatable(L, API_TYPE_TOKENIZER_PROGRAM);
+
+  if (lua_getfield(L, syntax, "patterns") != LUA_TTABLE) {
+    prog->unsupported = true;
+    lua_pop(L, 1);
+    return prog;
+  }
+  int npatterns = lua_rawlen(L, -1);
+  prog->patterns = SDL_calloc(npatterns > 0 ? npatterns : 1, sizeof(TokenPattern));
+  if (!prog->patterns) {
+    prog->unsupported = true;
+    lua_pop(L, 1);
+    return prog;
+  }
+  for (int i = 0; i < npatterns; i++)
+    prog->patterns[i].type_ref = prog->patterns[i].syntax_ref = LUA_NOREF;
+  prog->npatterns = npatterns;
+  lua_pushvalue(L, -1);
+  prog->patterns_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+  for (int i = 0; i < npatterns; i++) {
+    if (lua_rawgeti(L, -1, i + 1) != LUA_TTABLE
+        || !pattern_compile(L, lua_gettop(L), &prog->patterns[i]))
+      prog->unsupported = true;
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+  return prog;
+}
+
+static bool program_valid(lua_State *L, TokenProgram *prog, int syntax) {
+  if (prog->stale) return false;
+  lua_getfield(L, syntax, "patterns");
+  lua_rawgeti(L, LUA_REGISTRYINDEX, prog->patterns_ref);
+  bool valid = lua_rawequal(L, -1, -2) && (int)lua_rawlen(L, -1) == prog->npatterns;
+  lua_pop(L, 2);
+  return valid;
+}
+
+// Pushes the cached program of the syntax table at the given index,
+// compiling it again if its patterns table was replaced or resized.
+static TokenProgram *program_get(lua_State *L, int syntax) {
+  syntax = lua_absindex(L, syntax);
+  lua_rawgetp(L, LUA_REGISTRYINDEX, &programs_key);
+  lua_pushvalue(L, syntax);
+  lua_rawget(L, -2);
+  TokenProgram *prog = luaL_testudata(L, -1, API_TYPE_TOKENIZER_PROGRAM);
+  if (!prog || !program_valid(L, prog, syntax)) {
+    lua_pop(L, 1);
+    lua_pushvalue(L, syntax);
+    prog = program_compile(L, syntax);
+    lua_pushvalue(L, -1);
+    lua_insert(L, -4);
+    lua_rawset(L, -3);
+  } else {
+    lua_insert(L, -2);
+  }
+  lua_pop(L, 1);
+  return prog;
+}
+
+// Makes the syntax table at the top of the stack the current one, popping it.
+static TokenProgram *use_syntax(Tokenizer *tk) {
+  lua_State *L = tk->L;
+  TokenProgram *prog = program_get(L, -1);
+  // subsyntaxes may only be referenced from here, keep them alive
+  if (prog != tk->base) {
+    if (lua_isnil(L, tk->anchors)) {
+      lua_newtable(L);
+      lua_replace(L, tk->anchors);
+    }
+    lua_rawseti(L, tk->anchors, lua_rawlen(L, tk->anchors) + 1);
+  } else {
+    lua_pop(L, 1);
+  }
+  lua_getfield(L, -1, "symbols");
+  tk->has_symbols = false;
+  if (lua_istable(L, -1)) {
+    lua_pushnil(L);
+    if (lua_next(L, -2)) {
+      tk->has_symbols = true;
+      lua_pop(L, 2);
+    }
+  } else {
+    prog = NULL;
+  }
+  lua_replace(L, tk->symbols);
+  lua_pop(L, 1);
+  return prog && !prog->unsupported ? prog : NULL;
+}
+
+static TokenProgram *enter_syntax(Tokenizer *tk, TokenPattern *pat) {
+  lua_State *L = tk->L;
+  if (lua_rawgeti(L, LUA_REGISTRYINDEX, pat->syntax_ref) != LUA_TTABLE) {
+    lua_pushvalue(L, tk->get_syntax);
+    lua_insert(L, -2);
+    lua_call(L, 1, 1);
+    if (!lua_istable(L, -1)) {
+      lua_pop(L, 1);
+      return NULL;
+    }
+  }
+  return use_syntax(tk);
+}
+
+static bool retrieve_syntax_state(Tokenizer *tk) {
+  TokenProgram *prog = tk->base;
+  lua_pushvalue(tk->L, 1);
+  if (!use_syntax(tk)) return false;
+  tk->info = NULL;
+  tk->level = 1;
+  tk->pattern_idx = tk->state_len > 0 ? tk->state[0] : 0;
+  if (tk->pattern_idx > prog->npatterns) return false;
+  if (tk->pattern_idx > 0) {
+    for (int i = 0; i < tk->state_len; i++) {
+      int target = tk->state[i];
+      if (target == 0) break;
+      if (target > prog->npatterns) return false;
+      TokenPattern *pat = &prog->patterns[target - 1];
+      if (pat->syntax_ref != LUA_NOREF) {
+        tk->info = pat;
+        if (!(prog = enter_syntax(tk, pat))) return false;
+        tk->pattern_idx = 0;
+        tk->level = i + 2;
+      } else {
+        tk->pattern_idx = target;
+        break;
+      }
+    }
+  }
+  tk->prog = prog;
+  return true;
+}
+
+static bool set_pattern_idx(Tokenizer *tk, int pattern_idx) {
+  if (pattern_idx > 255) return false;
+  tk->pattern_idx = pattern_idx;
+  if (tk->level > tk->state_len) {
+    if (tk->state_len == MAX_STATE_DEPTH) return false;
+    tk->state[tk->state_len++] = pattern_idx;
+  } else {
+    tk->state[tk->level - 1] = pattern_idx;
+  }
+  return true;
+}
+
+static bool push_subsyntax(Tokenizer *tk, TokenPattern *pat, int pattern_idx) {
+  if (!set_pattern_idx(tk, pattern_idx)) return false;
+  tk->level++;
+  tk->info = pat;
+  tk->pattern_idx = 0;
+  return (tk->prog = enter_syntax(tk, pat)) != NULL;
+}
+
+static bool pop_subsyntax(Tokenizer *tk) {
+  tk->level--;
+  if (tk->state_len > tk->level) tk->state_len = tk->level;
+  return set_pattern_idx(tk, 0) && retrieve_syntax_state(tk);
+}
+
+// Returns the id of the pending token type, registering it in the types
+// table if needed, or 0 if the type can not be packed.
+static lua_Integer pending_type_id(Tokenizer *tk) {
+  lua_State *L = tk->L;
+  if (lua_type(L, tk->pending_type) != LUA_TSTRING) return 0;
+  lua_pushvalue(L, tk->pending_type);
+  lua_Integer id = lua_rawget(L, tk->types) == LUA_TNUMBER ? lua_tointeger(L, -1) : 0;
+  lua_pop(L, 1);
+  if (id > 0) return id <= PACKED_MAX_TYPE ? id : 0;
+  id = lua_rawlen(L, tk->types) + 1;
+  if (id > PACKED_MAX_TYPE) return 0;
+  lua_pushvalue(L, tk->pending_type);
+  lua_rawseti(L, tk->types, id);
+  lua_pushvalue(L, tk->pending_type);
+  lua_pushinteger(L, id);
+  lua_rawset(L, tk->types);
+  return id;
+}
+
+static bool pack_token(Tokenizer *tk) {
+  lua_State *L = tk->L;
+  lua_Integer id = pending_type_id(tk);
+  if (id == 0 || tk->pending_end > PACKED_MAX_OFFSET) return false;
+  if (tk->packed_len + PACKED_TOKEN_SIZE > tk->packed_cap) {
+    // the buffer is a userdata so that it is collected if an error is raised
+    size_t cap = tk->packed_cap > 0 ? tk->packed_cap * 2 : 64 * PACKED_TOKEN_SIZE;
+    unsigned char *packed = lua_newuserdatauv(L, cap, 0);
+    if (tk->packed_len > 0) memcpy(packed, tk->packed, tk->packed_len);
+    lua_replace(L, tk->buffer);
+    tk->packed = packed;
+    tk->packed_cap = cap;
+  }
+  unsigned char *p = tk->packed + tk->packed_len;
+  size_t end = tk->pending_end;
+  p[0] = end & 0xff;
+  p[1] = (end >> 8) & 0xff;
+  p[2] = (end >> 16) & 0xff;
+  p[3] = (end >> 24) & 0xff;
+  p[4] = id & 0xff;
+  p[5] = (id >> 8) & 0xff;
+  tk->packed_len += PACKED_TOKEN_SIZE;
+  return true;
+}
+
+// Expands the packed tokens into the result table, used when a packed line
+// has to be left incomplete and resumed later.
+static void unpack_tokens(Tokenizer *tk) {
+  lua_State *L = tk->L;
+  size_t start = 0;
+  for (size_t i = 0; i < tk->packed_len; i += PACKED_TOKEN_SIZE) {
+    const unsigned char *p = tk->packed + i;
+    size_t end = p[0] | (p[1] << 8) | ((size_t)p[2] << 16) | ((size_t)p[3] << 24);
+    lua_rawgeti(L, tk->types, p[4] | (p[5] << 8));
+    lua_rawseti(L, tk->res, tk->ntokens + 1);
+    lua_pushlstring(L, tk->text + start, end - start);
+    lua_rawseti(L, tk->res, tk->ntokens + 2);
+    tk->ntokens += 2;
+    start = end;
+  }
+  if (tk->ntokens > tk->max_written) tk->max_written = tk->ntokens;
+  tk->packed_len = 0;
+}
+
+static bool flush_token(Tokenizer *tk) {
+  lua_State *L = tk->L;
+  if (!tk->pending) return true;
+  tk->pending = false;
+  if (tk->packed) return pack_token(tk);
+  lua_pushvalue(L, tk->pending_type);
+  lua_rawseti(L, tk->res, tk->ntokens + 1);
+  lua_pushlstring(L, tk->text + tk->pending_start, tk->pending_end - tk->pending_start);
+  lua_rawseti(L, tk->res, tk->ntokens + 2);
+  tk->ntokens += 2;
+  if (tk->ntokens > tk->max_written) tk->max_written = tk->ntokens;
+  return true;
+}
+
+// Pops the token type from the stack and adds the text between s and e,
+// merging it into the previous token like push_token() in core.tokenizer.
+static bool push_token(Tokenizer *tk, size_t s, size_t e) {
+  lua_State *L = tk->L;
+  if (e <= s) {
+    lua_pop(L, 1);
+    return true;
+  }
+  if (!lua_toboolean(L, -1)) {
+    lua_pop(L, 1);
+    lua_pushliteral(L, "normal");
+  }
+  if (tk->pending && (tk->pending_blank || lua_rawequal(L, -1, tk->pending_type))) {
+    if (s != tk->pending_end) {
+      lua_pop(L, 1);
+      return false;
+    }
+    tk->pending_end = e;
+    tk->pending_blank = tk->pending_blank && utf8_isblank(tk->text + s, tk->text + e);
+  } else {
+    if (!flush_token(tk)) {
+      lua_pop(L, 1);
+      return false;
+    }
+    tk->pending = true;
+    tk->pending_start = s;
+    tk->pending_end = e;
+    tk->pending_blank = utf8_isblank(tk->text + s, tk->text + e);
+  }
+  lua_replace(L, tk->pending_type);
+  return true;
+}
+
+// Pushes element idx of the pattern type, or the whole type if idx is 0.
+static bool push_pattern_type(Tokenizer *tk, TokenPattern *pat, int idx) {
+  lua_State *L = tk->L;
+  int type = lua_rawgeti(L, LUA_REGISTRYINDEX, pat->type_ref);
+  if (idx == 0) return true;
+  if (type == LUA_TTABLE) {
+    lua_rawgeti(L, -1, idx);
+    lua_remove(L, -2);
+    return true;
+  }
+  lua_pop(L, 1);
+  lua_pushnil(L);
+  return type == LUA_TSTRING;
+}
+
+// The type used for the text between the delimiters of a pair.
+static void push_middle_type(Tokenizer *tk, TokenPattern *pat) {
+  lua_State *L = tk->L;
+  if (lua_rawgeti(L, LUA_REGISTRYINDEX, pat->type_ref) == LUA_TTABLE) {
+    if (lua_rawgeti(L, -1, 1) != LUA_TNIL && lua_toboolean(L, -1))
+      lua_remove(L, -2);
+    else
+      lua_pop(L, 1);
+  }
+}
+
+static bool push_span(Tokenizer *tk, TokenPattern *pat, int type_idx, size_t s, size_t e) {
+  lua_State *L = tk->L;
+  if (e > s && tk->has_symbols) {
+    lua_pushlstring(L, tk->text + s, e - s);
+    if (lua_gettable(L, tk->symbols) != LUA_TNIL && lua_toboolean(L, -1))
+      return push_token(tk, s, e);
+    lua_pop(L, 1);
+  }
+  return push_pattern_type(tk, pat, type_idx) && push_token(tk, s, e);
+}
+
+static bool push_tokens(Tokenizer *tk, TokenPattern *pat, const size_t *res, int n) {
+  if (n <= 2)
+    return push_span(tk, pat, 0, res[0], res[1]);
+  size_t start = res[0];
+  for (int i = 2; i <= n; i++) {
+    size_t fin = i < n ? res[i] : res[1];
+    if (fin < start) return false;
+    if (!push_span(tk, pat, i - 1, start, fin)) return false;
+    start = fin;
+  }
+  return true;
+}
+
+static int pattern_find(Tokenizer *tk, TokenMatcher *m, size_t offset, bool anchor, size_t *res) {
+  const char *r[MAX_RESULTS];
+  int n = utf8_pattern_find(tk->L, tk->text, tk->text + tk->len, tk->text + offset,
+                            m->code, m->code + m->len, anchor, r);
+  for (int i = 0; i < n; i++)
+    res[i] = r[i] - tk->text;
+  return n;
+}
+
+static int regex_find(Tokenizer *tk, TokenMatcher *m, size_t offset, bool anchor, size_t *res) {
+  // regex.find() is given the byte offset of a character, which does not
+  // exist past the end of the text
+  if (offset >= tk->len) return -1;
+  int rc = pcre2_match(m->re, (PCRE2_SPTR)tk->text + offset, tk->len - offset, 0,
+                       anchor ? PCRE2_ANCHORED : 0, m->md, NULL);
+  if (rc == PCRE2_ERROR_NOMATCH) return 0;
+  if (rc <= 0 || rc + 1 > MAX_RESULTS) return -1;
+  PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(m->md);
+  size_t s = ovector[0] + offset, e = ovector[1] + offset;
+  // the Lua tokenizer converts a match start to a character index by
+  // measuring up to its first byte, which is only exact for ASCII
+  if (ovector[0] > ovector[1] || s >= tk->len
+      || (s != offset && (unsigned char)tk->text[s] >= 0x80))
+    return -1;
+  res[0] = s;
+  res[1] = e;
+  for (int i = 1; i < rc; i++) {
+    // only empty groups are positions, anything else is a string capture
+    if (ovector[2*i] == PCRE2_UNSET || ovector[2*i] != ovector[2*i+1]) return -1;
+    res[i + 1] = ovector[2*i] + offset;
+  }
+  return rc + 1;
+}
+
+static bool is_escaped(Tokenizer *tk, TokenPattern *pat, size_t pos) {
+  int count = 0;
+  const char *text = tk->text;
+  while (pos > 0) {
+    size_t prev = pos - 1;
+    while (prev > 0 && (text[prev] & 0xC0) == 0x80) prev--;
+    if (pos - prev != (size_t)pat->escape_len || memcmp(text + prev, pat->escape, pat->escape_len))
+      break;
+    count++;
+    pos = prev;
+  }
+  return count % 2 == 1;
+}
+
+// Mirrors find_text() in core.tokenizer. Returns the number of results,
+// 0 if nothing was found or -1 if the Lua tokenizer has to handle it.
+static int find_text(Tokenizer *tk, TokenPattern *pat, size_t pos, bool at_start, bool close, size_t *res) {
+  TokenMatcher *m = &pat->match[close ? 1 : 0];
+  if (pat->disabled) return 0;
+  for (size_t next = pos;;) {
+    if (m->whole_line && next > 0) return 0;
+    bool anchor = at_start || m->whole_line;
+    int n = m->re ? regex_find(tk, m, next, anchor, res) : pattern_find(tk, m, next, anchor, res);
+    if (n <= 0 || pat->escape_len == 0 || !is_escaped(tk, pat, res[0])) return n;
+    if (at_start || !close) return 0;
+    if (res[1] == res[0]) return -1;
+    next = res[1];
+  }
+}
+
+static size_t char_offset(const char *text, size_t len, lua_Integer idx) {
+  size_t pos = 0;
+  while (pos < len && idx > 1) {
+    pos++;
+    while (pos < len && (text[pos] & 0xC0) == 0x80) pos++;
+    idx--;
+  }
+  return idx > 1 ? len + 1 : pos;
+}
+
+static lua_Integer char_index(const char *text, size_t pos) {
+  lua_Integer idx = 1;
+  for (size_t i = 0; i < pos; i++)
+    if ((text[i] & 0xC0) != 0x80) idx++;
+  return idx;
+}
+
+static int f_tokenize(lua_State *L) {
+  size_t len, state_len = 1;
+  luaL_checktype(L, 1, LUA_TTABLE);
+  const char *text = luaL_checklstring(L, 2, &len);
+  const char *state = lua_isnoneornil(L, 3) ? "\0" : luaL_checklstring(L, 3, &state_len);
+  luaL_checktype(L, 4, LUA_TFUNCTION);
+  double max_time = luaL_optnumber(L, 5, 0);
+  if (!lua_isnoneornil(L, 6)) luaL_checktype(L, 6, LUA_TTABLE);
+  lua_Integer start_idx = luaL_optinteger(L, 7, 1);
+  if (!lua_isnoneornil(L, 8)) luaL_checktype(L, 8, LUA_TTABLE);
+  lua_settop(L, 8);
+  if (lua_isnil(L, 6)) {
+    lua_newtable(L);
+    lua_replace(L, 6);
+  }
+  // 9: symbols of the current syntax, 10: type of the pending token,
+  // 11 and 12: the last token of a resumed result, restored on failure,
+  // 13: the programs of the subsyntaxes in use, 14: the base program,
+  // 15: the buffer of the packed tokens
+  lua_settop(L, 15);
+
+  Tokenizer tk = {
+    .L = L, .text = text, .len = len,
+    .get_syntax = 4, .res = 6, .types = 8, .symbols = 9, .pending_type = 10,
+    .anchors = 13, .buffer = 15, .state_len = state_len
+  };
+  lua_Integer initial = lua_rawlen(L, tk.res);
+  tk.ntokens = tk.max_written = initial;
+  // resumed lines keep the table they were started with
+  if (!lua_isnil(L, tk.types) && initial == 0) {
+    tk.packed_cap = (len < 64 ? len + 1 : 64) * PACKED_TOKEN_SIZE;
+    tk.packed = lua_newuserdatauv(L, tk.packed_cap, 0);
+    lua_replace(L, tk.buffer);
+  }
+
+  if (utf8_validlen(text, text + len) < 0 || start_idx < 1 || state_len > MAX_STATE_DEPTH || initial % 2)
+    return 0;
+  size_t pos = char_offset(text, len, start_idx);
+  memcpy(tk.state, state, state_len);
+
+  if (initial > 0) {
+    size_t prev_len;
+    lua_rawgeti(L, tk.res, initial - 1);
+    lua_rawgeti(L, tk.res, initial);
+    const char *prev_text = lua_type(L, -1) == LUA_TSTRING ? lua_tolstring(L, -1, &prev_len) : NULL;
+    lua_copy(L, -2, 11);
+    lua_copy(L, -1, 12);
+    lua_pop(L, 2);
+    if (!prev_text || pos > len || prev_len > pos || memcmp(text + pos - prev_len, prev_text, prev_len))
+      return 0;
+    lua_pushvalue(L, 11);
+    lua_replace(L, tk.pending_type);
+    tk.pending = true;
+    tk.pending_start = pos - prev_len;
+    tk.pending_end = pos;
+    tk.pending_blank = utf8_isblank(text + tk.pending_start, text + pos);
+    tk.ntokens -= 2;
+  }
+
+  tk.base = program_get(L, 1);
+  lua_replace(L, 14);
+  if (tk.base->unsupported || !retrieve_syntax_state(&tk))
+    goto fallback;
+
+  size_t res[MAX_RESULTS], sres[MAX_RESULTS];
+  size_t checked = pos;
+  Uint64 start_time = SDL_GetPerformanceCounter();
+  while (pos < len) {
+    if (max_time > 0 && pos - checked > 200) {
+      checked = pos;
+      if ((double)(SDL_GetPerformanceCounter() - start_time) / SDL_GetPerformanceFrequency() > max_time) {
+        if (!flush_token(&tk)) goto fallback;
+        unpack_tokens(&tk);
+        lua_pushliteral(L, "incomplete");
+        lua_rawseti(L, tk.res, tk.ntokens + 1);
+        lua_pushlstring(L, text + pos, len - pos);
+        lua_rawseti(L, tk.res, tk.ntokens + 2);
+        lua_pushvalue(L, tk.res);
+        lua_pushlstring(L, (const char *)tk.state, tk.state_len);
+        lua_pushinteger(L, char_index(text, pos));
+        return 3;
+      }
+    }
+    // continue trying to match the end pattern of a pair
+    if (tk.pattern_idx > 0) {
+      TokenPattern *pat = &tk.prog->patterns[tk.pattern_idx - 1];
+      if (!pat->pair) goto fallback;
+      int n = find_text(&tk, pat, pos, false, true, res);
+      if (n < 0) goto fallback;
+      bool cont = true;
+      // ending the subsyntax takes precedence over ending the delimiter
+      if (tk.info) {
+        int sn = find_text(&tk, tk.info, pos, false, true, sres);
+        if (sn < 0) goto fallback;
+        if (sn > 0 && (n == 0 || sres[0] < res[0])) {
+          push_middle_type(&tk, pat);
+          if (!push_token(&tk, pos, sres[0])) goto fallback;
+          pos = sres[0];
+          cont = false;
+        }
+      }
+      if (cont) {
+        if (n > 0) {
+          push_middle_type(&tk, pat);
+          if (!push_token(&tk, pos, res[0])
+              || !push_tokens(&tk, pat, res, n)
+              || !set_pattern_idx(&tk, 0))
+            goto fallback;
+          pos = res[1];
+        } else {
+          push_middle_type(&tk, pat);
+          if (!push_token(&tk, pos, len)) goto fallback;
+          break;
+        }
+      }
+    }
+    // general end of syntax check
+    while (tk.info) {
+      int n = find_text(&tk, tk.info, pos, true, true, res);
+      if (n < 0) goto fallback;
+      if (n == 0) break;
+      if (!push_tokens(&tk, tk.info, res, n) || !pop_subsyntax(&tk))
+        goto fallback;
+      pos = res[1];
+    }
+    // find matching pattern
+    bool matched = false;
+    for (int i = 0; i < tk.prog->npatterns; i++) {
+      TokenPattern *pat = &tk.prog->patterns[i];
+      int n = find_text(&tk, pat, pos, true, false, res);
+      if (n < 0) goto fallback;
+      if (n == 0) continue;
+      // patterns that match nothing or have the wrong number of types are
+      // reported by the Lua tokenizer, which also fixes up some of them
+      int type = lua_rawgeti(L, LUA_REGISTRYINDEX, pat->type_ref);
+      int ntypes = type == LUA_TTABLE ? (int)lua_rawlen(L, -1) : 1;
+      lua_pop(L, 1);
+      if (res[0] == res[1] || n - 1 != ntypes || (n == 2 && type == LUA_TTABLE)) {
+        if (res[0] != res[1] && n == 2 && type == LUA_TTABLE)
+          tk.prog->stale = true;
+        goto fallback;
+      }
+      if (!push_tokens(&tk, pat, res, n)) goto fallback;
+      if (pat->pair) {
+        if (pat->syntax_ref != LUA_NOREF) {
+          if (!push_subsyntax(&tk, pat, i + 1)) goto fallback;
+        } else if (!set_pattern_idx(&tk, i + 1)) {
+          goto fallback;
+        }
+      }
+      pos = res[1];
+      matched = true;
+      break;
+    }
+    // consume character if we didn't match
+    if (!matched && pos < len) {
+      size_t next = pos + 1;
+      while (next < len && (text[next] & 0xC0) == 0x80) next++;
+      lua_pushliteral(L, "normal");
+      if (!push_token(&tk, pos, next)) goto fallback;
+      pos = next;
+    }
+  }
+
+  if (!flush_token(&tk)) goto fallback;
+  if (tk.packed)
+    lua_pushlstring(L, (const char *)tk.packed, tk.packed_len);
+  else
+    lua_pushvalue(L, tk.res);
+  lua_pushlstring(L, (const char *)tk.state, tk.state_len);
+  return 2;
+
+fallback:
+  // leave the result table as it was given
+  for (lua_Integer i = tk.max_written; i > initial; i--) {
+    lua_pushnil(L);
+    lua_rawseti(L, tk.res, i);
+  }
+  if (initial > 0) {
+    lua_pushvalue(L, 11);
+    lua_rawseti(L, tk.res, initial - 1);
+    lua_pushvalue(L, 12);
+    lua_rawseti(L, tk.res, initial);
+  }
+  return 0;
+}
+
+static const luaL_Reg lib[] = {
+  { "tokenize", f_tokenize },
+  { NULL,       NULL       }
+};
+
+int luaopen_native_tokenizer(lua_State *L) {
+  luaL_newmetatable(L, API_TYPE_TOKENIZER_PROGRAM);
+  lua_pushcfunction(L, f_program_gc);
+  lua_setfield(L, -2, "__gc");
+  lua_pop(L, 1);
+
+  lua_newtable(L);
+  lua_newtable(L);
+  lua_pushliteral(L, "k");
+  lua_setfield(L, -2, "__mode");
+  lua_setmetatable(L, -2);
+  lua_rawsetp(L, LUA_REGISTRYINDEX, &programs_key);
+
+  luaL_newlib(L, lib);
+  return 1;
+}
@@ -33,6 +33,7 @@
 #include <string.h>
 
 #include "../unidata.h"
+#include "api.h"
 
 /* UTF-8 string operations */
 
@@ -1131,6 +1132,73 @@ static int find_aux (lua_State *L, int find) {
 static int Lutf8_find (lua_State *L) { return find_aux(L, 1); }
 static int Lutf8_match (lua_State *L) { return find_aux(L, 0); }
 
+/* C interface used by the native tokenizer */
+
+/* Behaves like string.ufind(s, p, init) with byte pointers: on a match
+** res[0] and res[1] receive the start and (exclusive) end of the match
+** and res[2..] the position captures. Returns the number of results, 0
+** if there is no match or -1 if the pattern has non-position captures. */
+int utf8_pattern_find (lua_State *L, const char *s, const char *es,
+                       const char *init, const char *p, const char *ep,
+                       int anchor, const char **res) {
+  if (!anchor && nospecials(p, ep)) {
+    const char *s2 = lmemfind(init, es-init, p, ep-p);
+    if (s2) {
+      const char *e2 = s2 + (ep - p);
+      if (iscont(e2)) e2 = utf8_next(e2, es);
+      res[0] = s2, res[1] = e2;
+      return 2;
+    }
+  } else {
+    MatchState ms;
+    if (!anchor && *p == '^') anchor = 1, p++;
+    ms.L = L;
+    ms.matchdepth = MAXCCALLS;
+    ms.src_init = s;
+    ms.src_end = es;
+    ms.p_end = ep;
+    do {
+      const char *e;
+      ms.level = 0;
+      assert(ms.matchdepth == MAXCCALLS);
+      if ((e = match(&ms, init, p)) != NULL) {
+        int i;
+        res[0] = init, res[1] = e;
+        for (i = 0; i < ms.level; i++) {
+          if (ms.capture[i].len != CAP_POSITION) return -1;
+          res[i + 2] = ms.capture[i].init;
+        }
+        return ms.level + 2;
+      }
+      if (init == es) break;
+      init = utf8_next(init, es);
+    } while (init <= es && !anchor);
+  }
+  return 0;
+}
+
+/* Returns whether every character in s..e is matched by '%s'. */
+int utf8_isblank (const char *s, const char *e) {
+  while (s < e) {
+    utfint ch = 0;
+    s = utf8_decode(s, &ch, 0);
+    if (s == NULL || !utf8_isspace(ch)) return 0;
+  }
+  return 1;
+}
+
+/* Returns the number of characters in s..e like string.ulen, or -1 if
+** it is not valid UTF-8. */
+ptrdiff_t utf8_validlen (const char *s, const char *e) {
+  ptrdiff_t n;
+  for (n = 0; s < e; ++n) {
+    utfint ch;
+    s = utf8_decode(s, &ch, 1);
+    if (s == NULL || utf8_invalid(ch)) return -1;
+  }
+  return n;
+}
+
 static int gmatch_aux (lua_State *L) {
   MatchState ms;
   const char *es, *s = check_utf8(L, lua_upvalueindex(1), &es);
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
 #include "api/api.h"
@@ -110,6 +111,15 @@ int main(int argc, char **argv) {
 
   SDL_SetAppMetadata("Lite XL", LITE_PROJECT_VERSION_STR, "com.lite_xl.LiteXL");
 
+  /* with --headless the editor draws to an offscreen window, so no display is needed */
+  int headless = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--headless") == 0) headless = 1;
+  }
+  if (headless) {
+    SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "dummy");
+  }
+
   if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS)) {
     fprintf(stderr, "Error initializing SDL: %s", SDL_GetError());
     exit(1);
@@ -160,6 +170,9 @@ init_lua:
   lua_pushboolean(L, has_restarted);
   lua_setglobal(L, "RESTARTED");
 
+  lua_pushboolean(L, headless);
+  lua_setglobal(L, "HEADLESS");
+
   char exename[2048];
   get_exe_filename(exename, sizeof(exename));
   if (*exename) {
@@ -230,6 +243,7 @@ init_lua:
 
   lua_close(L);
 
+  rencache_free();
   ren_free();
 
   return EXIT_SUCCESS;
@@ -5,35 +5,57 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <math.h>
 
 #ifdef _MSC_VER
   #ifndef alignof
     #define alignof _Alignof
   #endif
-  /* max_align_t is a compiler defined type, but
-  ** MSVC doesn't provide it, so we'll have to improvise */
-  typedef long double max_align_t;
 #else
   #include <stdalign.h>
 #endif
 
+#ifdef _MSC_VER
+  #include <intrin.h>
+#endif
+
 #include <lauxlib.h>
 #include "rencache.h"
 #include "renwindow.h"
 
 /* a cache over the software renderer -- all drawing operations are stored as
 ** commands when issued. At the end of the frame we write the commands to a grid
-** of hash values, take the cells that have changed since the previous frame,
-** merge them into dirty rectangles and redraw only those regions */
+** of hash values (one per window, sized to cover its surface), take the cells
+** that have changed since the previous frame,
+** merge them into dirty rectangles and redraw only those regions.
+** The changed cells are also split into disjoint tiles, which are redrawn by a
+** pool of worker threads when there are enough of them to be worth it.
+** While hashing, every draw command is also binned into the cells it touches,
+** text including how far its glyphs can reach out of their box, so that a tile
+** only replays the commands that overlap it.
+** When a region is declared as scrolled, its pixels are moved on the surface and
+** its cells are compared against the previous frame's commands moved the same
+** way, so that only what the move didn't reproduce gets redrawn.
+** Commands can also be recorded into a display list once and replayed by
+** reference on the following frames, with the hashes of its commands kept. */
 
-#define CELLS_X 80
-#define CELLS_Y 50
+/* the default cell size in pixels, divided by the surface scale to get points */
 #define CELL_SIZE 96
+#define MIN_CELL_SIZE 8
 #define CMD_BUF_RESIZE_RATE 1.2
 #define CMD_BUF_INIT_SIZE (1024 * 512)
 #define COMMAND_BARE_SIZE offsetof(Command, command)
+#define MAX_RENDER_THREADS 8
+/* minimum number of changed cells before the redraw is split between threads */
+#define PARALLEL_MIN_CELLS 24
+/* the cost of updating one more rect, as an area in points */
+#define RECT_OVERHEAD (128 * 128)
+/* rects are merged by groups of this many neighbours, as finding the best pair is quadratic */
+#define RECT_MERGE_WINDOW 32
+#define MAX_SCROLLS 8
+#define MAX_FONT_GROUPS UINT16_MAX
 
-enum CommandType { SET_CLIP, DRAW_TEXT, DRAW_RECT };
+enum CommandType { SET_CLIP, DRAW_TEXT, DRAW_TEXT_RUNS, DRAW_RECT, DRAW_OVERLAY, DRAW_LIST };
 
 typedef struct {
   enum CommandType type;
@@ -47,49 +69,287 @@ typedef struct {
   RenRect rect;
 } SetClipCommand;
 
+/* commands are aligned to what their fields need, not to max_align_t */
+typedef union { void *ptr; double d; } CommandAlign;
+
+/* laid out without padding, so that hashing it up to the end of the text
+** never reads uninitialized bytes */
 typedef struct {
   RenRect rect;
   RenColor color;
-  RenFont *fonts[FONT_FALLBACK_MAX];
+  uint16_t font_group; /* index in font_groups */
+  uint16_t tab_size; /* as wide as the tab size of fonts */
   float text_x;
-  size_t len;
-  int8_t tab_size;
+  uint32_t len;
   RenTab tab;
   char text[];
 } DrawTextCommand;
 
+/* one of the runs of a DrawTextRunsCommand, laid out without padding too */
+typedef struct {
+  RenColor color;
+  uint16_t font_group;
+  uint16_t tab_size;
+  float text_x;
+  uint32_t len;
+  RenTab tab;
+} TextRunEntry;
+
+/* runs of text drawn one after the other (e.g. the tokens of a line), in a
+** single command that is hashed as a whole. The runs are followed by their
+** text, one after the other */
+typedef struct {
+  RenRect rect; /* bounds of all the runs */
+  uint32_t count, len;
+  TextRunEntry runs[];
+} DrawTextRunsCommand;
+
 typedef struct {
   RenRect rect;
   RenColor color;
 } DrawRectCommand;
 
-static unsigned cells_buf1[CELLS_X * CELLS_Y];
-static unsigned cells_buf2[CELLS_X * CELLS_Y];
-static unsigned *cells_prev = cells_buf1;
-static unsigned *cells = cells_buf2;
-static RenRect rect_buf[CELLS_X * CELLS_Y / 2];
-static bool resize_issue;
-static RenRect screen_rect;
-static RenRect last_clip_rect;
+/* a rect drawn only while the window's overlays are visible (e.g. a caret),
+** which rencache_show_overlays() repaints without a new frame */
+typedef struct {
+  RenRect rect;
+  RenColor color;
+  uint32_t visible; /* stamped at the end of the frame, hashed with the color */
+} DrawOverlayCommand;
+
+/* the commands of a list keep their own clip rects, which are intersected with
+** the clip in effect where the list is drawn. A list stays allocated while the
+** command buffers still refer to it, even after being freed. The previous
+** recording is kept so that the last frame can still be scrolled. */
+struct RenDisplayList {
+  uint8_t *buf, *old_buf;
+  size_t buf_idx, buf_size, old_buf_idx, old_buf_size;
+  unsigned old_version;
+  uint64_t *hashes; /* one per drawing command */
+  int hash_count, hash_capacity;
+  RenRect rect;
+  unsigned version;
+  int refs;
+  bool freed;
+};
+
+typedef struct {
+  RenRect rect;
+  RenDisplayList *list;
+  unsigned version;
+} DrawListCommand;
+
+static int cell_size_px = CELL_SIZE;
 static bool show_debug;
 
+/* text commands refer to their fonts through this table. A group is counted
+** once per text command or run that refers to it, in any command buffer or
+** display list, and its slot is only reused once none does. The previous
+** frame of every window holds its references, so an index means the same
+** fonts in the frames whose text hashes are compared */
+typedef struct {
+  RenFont *fonts[FONT_FALLBACK_MAX];
+  uint32_t refs;
+} FontGroup;
+static FontGroup *font_groups;
+static int font_group_count, font_group_capacity, font_group_last;
+
+/* the runs of rencache_draw_text_runs() are measured here before being pushed */
+typedef struct {
+  TextRunEntry entry;
+  const char *text;
+} PendingTextRun;
+static PendingTextRun *pending_runs;
+static int pending_run_capacity;
+
+/* a draw command along with the clip rect that was active when it was issued */
+typedef struct {
+  Command *cmd;
+  RenRect clip;
+} BinnedCommand;
+
+typedef struct {
+  int cmd, next;
+} BinEntry;
+
+/* each cell holds a linked list of the indexes (into `cmds`) of the commands
+** touching it. `tile_cmds` holds the ordered, deduplicated commands to replay
+** for each tile, starting at `tile_starts[tile]`. */
+typedef struct {
+  BinnedCommand *cmds;
+  int cmd_count, cmd_capacity;
+  BinEntry *entries;
+  int entry_count, entry_capacity;
+  int *heads;
+  uint32_t *marks;
+  int marks_capacity;
+  int *tile_cmds;
+  int tile_cmds_capacity;
+  int *tile_starts;
+  bool overflow;
+} CommandBins;
+
+typedef struct {
+  RenRect rect;
+  int dx, dy;
+} ScrollRegion;
+
+/* the diff state of a window, the grid is reallocated whenever the size of
+** the window or the cell size changes. The commands of the previous frame are
+** kept in `prev_buf` to rehash the regions scrolled in the current one. */
+struct RenCache {
+  int cell_size; /* in points */
+  int cells_x, cells_y;
+  uint64_t *cells, *cells_prev;
+  RenRect *rect_buf, *tile_buf;
+  RenRect screen_rect;
+  RenRect last_clip_rect;
+  bool resize_issue;
+  CommandBins bins;
+  uint8_t *prev_buf;
+  size_t prev_buf_idx, prev_buf_size;
+  bool prev_valid;
+  ScrollRegion scrolls[MAX_SCROLLS];
+  int scroll_count;
+  uint8_t *moved_cmd; /* a copy of a previous command, moved by a scroll to be hashed */
+  int moved_cmd_capacity;
+  /* while a list is recorded, it takes the place of the window's command buffer */
+  RenDisplayList *recording;
+  uint8_t *saved_buf;
+  size_t saved_buf_idx, saved_buf_size;
+  RenRect saved_clip_rect;
+  RenCacheStats stats, frame_stats;
+  RenGlyphStats frame_glyphs; /* the totals when the frame began */
+  bool in_frame;
+  bool overlays_visible;
+};
+
+typedef struct {
+  RenWindow *window_renderer;
+  RenSurface rs;
+  int tile_count;
+  SDL_AtomicInt next_tile;
+} RenderJob;
+
+/* worker threads are started on the first frame that needs them and wait on
+** `start` for a new `generation` of work */
+static struct {
+  SDL_Thread *threads[MAX_RENDER_THREADS];
+  int count;
+  bool started, quit;
+  unsigned generation;
+  int busy;
+  RenderJob *job;
+  SDL_Mutex *mutex;
+  SDL_Condition *start, *done;
+} workers;
+
 static inline int rencache_min(int a, int b) { return a < b ? a : b; }
 static inline int rencache_max(int a, int b) { return a > b ? a : b; }
 
 
-/* 32bit fnv-1a hash */
-#define HASH_INITIAL 2166136261
+/* 64bit word-at-a-time hash, using the xxHash64 primes and rounds */
+#define HASH_INITIAL 0x27d4eb2f165667c5ULL
+#define HASH_PRIME1 0x9e3779b185ebca87ULL
+#define HASH_PRIME2 0xc2b2ae3d27d4eb4fULL
+#define HASH_PRIME3 0x165667b19e3779f9ULL
+
+static inline uint64_t hash_rotl(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+
+static inline uint64_t hash_round(uint64_t acc, uint64_t word) {
+  return hash_rotl(acc + word * HASH_PRIME2, 31) * HASH_PRIME1;
+}
+
+
+static inline uint64_t hash_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= HASH_PRIME2;
+  h ^= h >> 29;
+  h *= HASH_PRIME3;
+  return h ^ (h >> 32);
+}
+
 
-static void hash(unsigned *h, const void *data, int size) {
+static uint64_t hash(const void *data, size_t size) {
   const unsigned char *p = data;
-  while (size--) {
-    *h = (*h ^ *p++) * 16777619;
+  uint64_t h = HASH_INITIAL + size, word;
+  /* four independent lanes keep the multiplier busy on long text commands */
+  if (size >= 32) {
+    uint64_t lanes[4] = { HASH_PRIME1, HASH_PRIME2, HASH_PRIME3, HASH_INITIAL };
+    for (; size >= 32; size -= 32, p += 32) {
+      for (int i = 0; i < 4; i++) {
+        memcpy(&word, p + i * 8, sizeof(word));
+        lanes[i] = hash_round(lanes[i], word);
+      }
+    }
+    h += hash_rotl(lanes[0], 1) + hash_rotl(lanes[1], 7) + hash_rotl(lanes[2], 12) + hash_rotl(lanes[3], 18);
+  }
+  for (; size >= 8; size -= 8, p += 8) {
+    memcpy(&word, p, sizeof(word));
+    h = hash_rotl(h ^ hash_round(0, word), 27) * HASH_PRIME1 + HASH_PRIME3;
+  }
+  for (; size > 0; size--) {
+    h = hash_rotl(h ^ (*p++ * HASH_PRIME1), 11) * HASH_PRIME2;
+  }
+  return hash_mix(h);
+}
+
+
+/* folds a command hash into a cell, the order of the commands matters */
+static inline void hash_cell(uint64_t *cell, uint64_t h) {
+  *cell = hash_rotl(*cell ^ h, 29) * HASH_PRIME1;
+}
+
+
+/* a cell's hash should only depend on what is drawn inside of it: a rect fills
+** all of its visible area `r` with its color, wherever its edges are, while
+** text is positioned from the whole command and is only limited by the clip */
+static uint64_t hash_command(Command *cmd) {
+  if (cmd->type == DRAW_RECT) {
+    return hash(&((DrawRectCommand *) cmd->command)->color, sizeof(RenColor));
   }
+  if (cmd->type == DRAW_OVERLAY) {
+    return hash(&((DrawOverlayCommand *) cmd->command)->color, sizeof(RenColor) + sizeof(uint32_t));
+  }
+  if (cmd->type == DRAW_TEXT) {
+    return hash(cmd, COMMAND_BARE_SIZE + sizeof(DrawTextCommand) + ((DrawTextCommand *) cmd->command)->len);
+  }
+  return hash(cmd, cmd->size);
+}
+
+
+static inline RenRect command_bounds(Command *cmd, RenRect r, RenRect clip) {
+  return cmd->type == DRAW_RECT || cmd->type == DRAW_OVERLAY ? r : clip;
+}
+
+
+static inline int cell_idx(RenCache *rc, int x, int y) {
+  return x + y * rc->cells_x;
 }
 
 
-static inline int cell_idx(int x, int y) {
-  return x + y * CELLS_X;
+static inline int lowest_bit(uint32_t v) {
+#ifdef _MSC_VER
+  unsigned long idx;
+  _BitScanForward(&idx, v);
+  return (int) idx;
+#else
+  return __builtin_ctz(v);
+#endif
+}
+
+
+static bool grow_array(void **array, int *capacity, int needed, size_t elem_size) {
+  if (needed <= *capacity) { return true; }
+  int new_capacity = rencache_max(*capacity * 2, rencache_max(needed, 1024));
+  void *new_array = SDL_realloc(*array, new_capacity * elem_size);
+  if (!new_array) { return false; }
+  *array = new_array;
+  *capacity = new_capacity;
+  return true;
 }
 
 
@@ -108,6 +368,11 @@ static RenRect intersect_rects(RenRect a, RenRect b) {
 }
 
 
+static inline int rect_area(RenRect r) {
+  return r.width * r.height;
+}
+
+
 static RenRect merge_rects(RenRect a, RenRect b) {
   int x1 = rencache_min(a.x, b.x);
   int y1 = rencache_min(a.y, b.y);
@@ -130,30 +395,61 @@ static bool expand_command_buffer(RenWindow *window_renderer) {
   return true;
 }
 
+/* returns the index of a font group, adding it to the table if it's new; the
+** caller adds a reference for each command or run that ends up using it */
+static int intern_font_group(RenFont **fonts) {
+  const size_t size = sizeof(RenFont*) * FONT_FALLBACK_MAX;
+  /* consecutive text commands mostly use the same fonts */
+  if (font_group_last < font_group_count && memcmp(font_groups[font_group_last].fonts, fonts, size) == 0) {
+    return font_group_last;
+  }
+  int unused = -1;
+  for (int i = 0; i < font_group_count; i++) {
+    if (memcmp(font_groups[i].fonts, fonts, size) == 0) { return font_group_last = i; }
+    if (unused < 0 && font_groups[i].refs == 0) { unused = i; }
+  }
+  if (unused < 0) {
+    if (font_group_count == MAX_FONT_GROUPS
+        || !grow_array((void **) &font_groups, &font_group_capacity, font_group_count + 1, sizeof(FontGroup))) {
+      fprintf(stderr, "Warning: (" __FILE__ "): unable to add a font group\n");
+      return -1;
+    }
+    unused = font_group_count++;
+  }
+  memcpy(font_groups[unused].fonts, fonts, size);
+  font_groups[unused].refs = 0;
+  return font_group_last = unused;
+}
+
+
+/* the command is returned uninitialized, except for the padding after it */
 static void* push_command(RenWindow *window_renderer, enum CommandType type, int size) {
-  if (!window_renderer || resize_issue) {
+  if (!window_renderer || !window_renderer->cache || window_renderer->cache->resize_issue) {
     // Don't push new commands as we had problems resizing the command buffer.
     // Or, we don't have an active buffer.
     // Let's wait for the next frame.
     return NULL;
   }
-  size_t alignment = alignof(max_align_t) - 1;
+  size_t alignment = alignof(CommandAlign) - 1;
   size += COMMAND_BARE_SIZE;
+  int unpadded = size;
   size = (size + alignment) & ~alignment;
   int n = window_renderer->command_buf_idx + size;
   while (n > window_renderer->command_buf_size) {
     if (!expand_command_buffer(window_renderer)) {
       fprintf(stderr, "Warning: (" __FILE__ "): unable to resize command buffer (%zu)\n",
               (size_t)(window_renderer->command_buf_size * CMD_BUF_RESIZE_RATE));
-      resize_issue = true;
+      window_renderer->cache->resize_issue = true;
       return NULL;
     }
   }
   Command *cmd = (Command*) (window_renderer->command_buf + window_renderer->command_buf_idx);
   window_renderer->command_buf_idx = n;
-  memset(cmd, 0, size);
+  memset((uint8_t *) cmd + unpadded, 0, size - unpadded);
   cmd->type = type;
   cmd->size = size;
+  window_renderer->cache->frame_stats.commands++;
+  window_renderer->cache->frame_stats.command_bytes += size;
   return cmd->command;
 }
 
@@ -173,17 +469,40 @@ void rencache_show_debug(bool enable) {
 }
 
 
+void rencache_set_cell_size(int size) {
+  cell_size_px = size > 0 ? rencache_max(size, MIN_CELL_SIZE) : CELL_SIZE;
+}
+
+
 void rencache_set_clip_rect(RenWindow *window_renderer, RenRect rect) {
   SetClipCommand *cmd = push_command(window_renderer, SET_CLIP, sizeof(SetClipCommand));
   if (cmd) {
-    cmd->rect = intersect_rects(rect, screen_rect);
-    last_clip_rect = cmd->rect;
+    RenCache *rc = window_renderer->cache;
+    cmd->rect = intersect_rects(rect, rc->screen_rect);
+    rc->last_clip_rect = cmd->rect;
   }
 }
 
 
+void rencache_scroll_rect(RenWindow *window_renderer, RenRect rect, int dx, int dy) {
+  if (!window_renderer || !window_renderer->cache || show_debug) { return; }
+  RenCache *rc = window_renderer->cache;
+  rect = intersect_rects(rect, rc->screen_rect);
+  if ((dx == 0 && dy == 0) || abs(dx) >= rect.width || abs(dy) >= rect.height
+      || rc->scroll_count == MAX_SCROLLS) {
+    return;
+  }
+  /* the previous frame's commands can't be moved twice, keep the first one */
+  for (int i = 0; i < rc->scroll_count; i++) {
+    if (rect_area(intersect_rects(rc->scrolls[i].rect, rect)) > 0) { return; }
+  }
+  rc->scrolls[rc->scroll_count++] = (ScrollRegion) { rect, dx, dy };
+}
+
+
 void rencache_draw_rect(RenWindow *window_renderer, RenRect rect, RenColor color) {
-  if (rect.width == 0 || rect.height == 0 || !rects_overlap(last_clip_rect, rect)) {
+  if (rect.width == 0 || rect.height == 0 || !window_renderer || !window_renderer->cache
+      || !rects_overlap(window_renderer->cache->last_clip_rect, rect)) {
     return;
   }
   DrawRectCommand *cmd = push_command(window_renderer, DRAW_RECT, sizeof(DrawRectCommand));
@@ -193,22 +512,42 @@ void rencache_draw_rect(RenWindow *window_renderer, RenRect rect, RenColor color
   }
 }
 
+void rencache_draw_overlay(RenWindow *window_renderer, RenRect rect, RenColor color) {
+  if (rect.width == 0 || rect.height == 0 || !window_renderer || !window_renderer->cache
+      || !rects_overlap(window_renderer->cache->last_clip_rect, rect)) {
+    return;
+  }
+  /* lists are replayed as they were recorded, so they only hold plain rects */
+  if (window_renderer->cache->recording) {
+    rencache_draw_rect(window_renderer, rect, color);
+    return;
+  }
+  DrawOverlayCommand *cmd = push_command(window_renderer, DRAW_OVERLAY, sizeof(DrawOverlayCommand));
+  if (cmd) {
+    cmd->rect = rect;
+    cmd->color = color;
+    cmd->visible = 0;
+  }
+}
+
 double rencache_draw_text(RenWindow *window_renderer, RenFont **fonts, const char *text, size_t len, double x, int y, RenColor color, RenTab tab)
 {
   int x_offset;
   double width = ren_font_group_get_width(fonts, text, len, tab, &x_offset);
   RenRect rect = { x + x_offset, y, (int)(width - x_offset), ren_font_group_get_height(fonts) };
-  if (rects_overlap(last_clip_rect, rect)) {
-    int sz = len + 1;
-    DrawTextCommand *cmd = push_command(window_renderer, DRAW_TEXT, sizeof(DrawTextCommand) + sz);
+  if (window_renderer && window_renderer->cache && rects_overlap(window_renderer->cache->last_clip_rect, rect)
+      && len <= UINT32_MAX) {
+    int font_group = intern_font_group(fonts);
+    DrawTextCommand *cmd = font_group < 0 ? NULL : push_command(window_renderer, DRAW_TEXT, sizeof(DrawTextCommand) + len);
     if (cmd) {
-      memcpy(cmd->text, text, sz);
+      font_groups[font_group].refs++;
+      memcpy(cmd->text, text, len);
       cmd->color = color;
-      memcpy(cmd->fonts, fonts, sizeof(RenFont*)*FONT_FALLBACK_MAX);
+      cmd->font_group = font_group;
       cmd->rect = rect;
+      cmd->tab_size = ren_font_group_get_tab_size(fonts);
       cmd->text_x = x;
       cmd->len = len;
-      cmd->tab_size = ren_font_group_get_tab_size(fonts);
       cmd->tab = tab;
     }
   }
@@ -216,134 +555,1072 @@ double rencache_draw_text(RenWindow *window_renderer, RenFont **fonts, const cha
 }
 
 
+double rencache_draw_text_runs(RenWindow *window_renderer, RenTextRun *runs, int count, double x, int y, double max_x, RenTab tab)
+{
+  /* measured like rencache_draw_text() would, with tab stops relative to `x - tab.offset` */
+  const double start_x = x - (isnan(tab.offset) ? 0 : tab.offset);
+  RenRect bounds = { 0 };
+  size_t len = 0;
+  int n = 0;
+  bool can_push = window_renderer && window_renderer->cache
+    && grow_array((void **) &pending_runs, &pending_run_capacity, count, sizeof(PendingTextRun));
+  for (int i = 0; i < count && x <= max_x; i++) {
+    RenTab run_tab = { x - start_x };
+    int x_offset;
+    double width = ren_font_group_get_width(runs[i].fonts, runs[i].text, runs[i].len, run_tab, &x_offset);
+    RenRect rect = { x + x_offset, y, (int)(width - x_offset), ren_font_group_get_height(runs[i].fonts) };
+    if (can_push && rects_overlap(window_renderer->cache->last_clip_rect, rect) && runs[i].len <= UINT32_MAX) {
+      int font_group = intern_font_group(runs[i].fonts);
+      if (font_group >= 0) {
+        pending_runs[n++] = (PendingTextRun) { {
+          .color = runs[i].color, .font_group = font_group, .tab_size = ren_font_group_get_tab_size(runs[i].fonts),
+          .text_x = x, .len = runs[i].len, .tab = run_tab
+        }, runs[i].text };
+        bounds = n == 1 ? rect : merge_rects(bounds, rect);
+        len += runs[i].len;
+      }
+    }
+    x += width;
+  }
+  DrawTextRunsCommand *cmd = n == 0 || len > UINT32_MAX ? NULL
+    : push_command(window_renderer, DRAW_TEXT_RUNS, sizeof(DrawTextRunsCommand) + sizeof(TextRunEntry) * n + len);
+  if (cmd) {
+    cmd->rect = bounds;
+    cmd->count = n;
+    cmd->len = len;
+    char *text = (char *) &cmd->runs[n];
+    for (int i = 0; i < n; i++) {
+      font_groups[pending_runs[i].entry.font_group].refs++;
+      cmd->runs[i] = pending_runs[i].entry;
+      memcpy(text, pending_runs[i].text, pending_runs[i].entry.len);
+      text += pending_runs[i].entry.len;
+    }
+  }
+  return x;
+}
+
+
+RenDisplayList *rencache_list_new(void) {
+  return SDL_calloc(1, sizeof(RenDisplayList));
+}
+
+
+static void release_commands(uint8_t *buf, size_t idx);
+
+static void destroy_list(RenDisplayList *list) {
+  release_commands(list->buf, list->buf_idx);
+  release_commands(list->old_buf, list->old_buf_idx);
+  SDL_free(list->buf);
+  SDL_free(list->old_buf);
+  SDL_free(list->hashes);
+  SDL_free(list);
+}
+
+
+void rencache_list_free(RenDisplayList *list) {
+  if (!list) { return; }
+  list->freed = true;
+  if (list->refs == 0) { destroy_list(list); }
+}
+
+
+/* drops the references held by the commands of a buffer that is about to be
+** reused, on display lists and font groups */
+static void release_commands(uint8_t *buf, size_t idx) {
+  for (size_t i = 0; i < idx; i += ((Command *) (buf + i))->size) {
+    Command *cmd = (Command *) (buf + i);
+    if (cmd->type == DRAW_LIST) {
+      RenDisplayList *list = ((DrawListCommand *) cmd->command)->list;
+      if (--list->refs == 0 && list->freed) { destroy_list(list); }
+    } else if (cmd->type == DRAW_TEXT) {
+      font_groups[((DrawTextCommand *) cmd->command)->font_group].refs--;
+    } else if (cmd->type == DRAW_TEXT_RUNS) {
+      DrawTextRunsCommand *rscmd = (DrawTextRunsCommand *) cmd->command;
+      for (uint32_t j = 0; j < rscmd->count; j++) {
+        font_groups[rscmd->runs[j].font_group].refs--;
+      }
+    }
+  }
+}
+
+
+bool rencache_begin_list(RenWindow *window_renderer, RenDisplayList *list) {
+  if (!window_renderer || !window_renderer->cache || window_renderer->cache->recording) {
+    return false;
+  }
+  RenCache *rc = window_renderer->cache;
+  rc->recording = list;
+  rc->saved_buf = window_renderer->command_buf;
+  rc->saved_buf_idx = window_renderer->command_buf_idx;
+  rc->saved_buf_size = window_renderer->command_buf_size;
+  rc->saved_clip_rect = rc->last_clip_rect;
+  release_commands(list->old_buf, list->old_buf_idx);
+  uint8_t *buf = list->old_buf;
+  size_t buf_size = list->old_buf_size;
+  list->old_buf = list->buf;
+  list->old_buf_idx = list->buf_idx;
+  list->old_buf_size = list->buf_size;
+  list->old_version = list->version;
+  list->buf = NULL;
+  list->buf_idx = list->buf_size = 0;
+  window_renderer->command_buf = buf;
+  window_renderer->command_buf_idx = 0;
+  window_renderer->command_buf_size = buf_size;
+  rc->last_clip_rect = rc->screen_rect;
+  return true;
+}
+
+
+void rencache_end_list(RenWindow *window_renderer) {
+  if (!window_renderer || !window_renderer->cache || !window_renderer->cache->recording) {
+    return;
+  }
+  RenCache *rc = window_renderer->cache;
+  RenDisplayList *list = rc->recording;
+  list->buf = window_renderer->command_buf;
+  list->buf_idx = window_renderer->command_buf_idx;
+  list->buf_size = window_renderer->command_buf_size;
+  list->version++;
+  window_renderer->command_buf = rc->saved_buf;
+  window_renderer->command_buf_idx = rc->saved_buf_idx;
+  window_renderer->command_buf_size = rc->saved_buf_size;
+  rc->last_clip_rect = rc->saved_clip_rect;
+  rc->recording = NULL;
+
+  /* hash the commands once for all the frames that draw the list */
+  list->hash_count = 0;
+  list->rect = (RenRect) { 0 };
+  RenRect cr = rc->screen_rect;
+  for (size_t i = 0; i < list->buf_idx; i += ((Command *) (list->buf + i))->size) {
+    Command *cmd = (Command *) (list->buf + i);
+    if (cmd->type == SET_CLIP) { cr = cmd->command[0]; continue; }
+    if (!grow_array((void **) &list->hashes, &list->hash_capacity, list->hash_count + 1, sizeof(uint64_t))) {
+      fprintf(stderr, "Warning: (" __FILE__ "): unable to hash display list\n");
+      release_commands(list->buf + i, list->buf_idx - i);
+      list->buf_idx = i;
+      break;
+    }
+    list->hashes[list->hash_count++] = hash_command(cmd);
+    RenRect r = intersect_rects(cmd->command[0], cr);
+    if (r.width > 0 && r.height > 0) {
+      list->rect = rect_area(list->rect) > 0 ? merge_rects(list->rect, r) : r;
+    }
+  }
+}
+
+
+void rencache_draw_list(RenWindow *window_renderer, RenDisplayList *list) {
+  if (!window_renderer || !window_renderer->cache || window_renderer->cache->recording
+      || !rects_overlap(window_renderer->cache->last_clip_rect, list->rect) || rect_area(list->rect) == 0) {
+    return;
+  }
+  DrawListCommand *cmd = push_command(window_renderer, DRAW_LIST, sizeof(DrawListCommand));
+  if (cmd) {
+    cmd->rect = list->rect;
+    cmd->list = list;
+    cmd->version = list->version;
+    list->refs++;
+  }
+}
+
+
+static void free_grid(RenCache *rc) {
+  SDL_free(rc->cells);
+  SDL_free(rc->cells_prev);
+  SDL_free(rc->rect_buf);
+  SDL_free(rc->tile_buf);
+  SDL_free(rc->bins.heads);
+  SDL_free(rc->bins.tile_starts);
+  rc->cells = rc->cells_prev = NULL;
+  rc->rect_buf = rc->tile_buf = NULL;
+  rc->bins.heads = rc->bins.tile_starts = NULL;
+  rc->cells_x = rc->cells_y = 0;
+}
+
+
+static bool resize_grid(RenCache *rc, int w, int h, int cell_size) {
+  /* commands are clipped to the screen, so they only ever reach the cell at w / cell_size */
+  int cells_x = w / cell_size + 1;
+  int cells_y = h / cell_size + 1;
+  size_t count = (size_t) cells_x * cells_y;
+  free_grid(rc);
+  rc->cells = SDL_malloc(count * sizeof(uint64_t));
+  rc->cells_prev = SDL_malloc(count * sizeof(uint64_t));
+  rc->rect_buf = SDL_malloc((count + MAX_SCROLLS) * sizeof(RenRect));
+  rc->tile_buf = SDL_malloc(count * sizeof(RenRect));
+  rc->bins.heads = SDL_malloc(count * sizeof(int));
+  rc->bins.tile_starts = SDL_malloc((count + 1) * sizeof(int));
+  if (!rc->cells || !rc->cells_prev || !rc->rect_buf || !rc->tile_buf || !rc->bins.heads || !rc->bins.tile_starts) {
+    fprintf(stderr, "Warning: (" __FILE__ "): unable to allocate a %dx%d cell grid\n", cells_x, cells_y);
+    free_grid(rc);
+    return false;
+  }
+  rc->cells_x = cells_x;
+  rc->cells_y = cells_y;
+  rc->cell_size = cell_size;
+  for (size_t i = 0; i < count; i++) {
+    rc->cells[i] = HASH_INITIAL;
+  }
+  memset(rc->cells_prev, 0xff, count * sizeof(uint64_t));
+  rc->prev_valid = false;
+  return true;
+}
+
+
+static void invalidate_window(RenWindow *window_renderer) {
+  RenCache *rc = window_renderer->cache;
+  if (rc && rc->cells_prev) {
+    memset(rc->cells_prev, 0xff, (size_t) rc->cells_x * rc->cells_y * sizeof(uint64_t));
+    rc->prev_valid = false;
+  }
+}
+
+
 void rencache_invalidate(void) {
-  memset(cells_prev, 0xff, sizeof(cells_buf1));
+  RenWindow **window_list;
+  size_t window_count = ren_get_window_list(&window_list);
+  for (size_t i = 0; i < window_count; i++) {
+    invalidate_window(window_list[i]);
+  }
+}
+
+
+void rencache_free_window(RenWindow *window_renderer) {
+  RenCache *rc = window_renderer->cache;
+  if (!rc) { return; }
+  free_grid(rc);
+  SDL_free(rc->bins.cmds);
+  SDL_free(rc->bins.entries);
+  SDL_free(rc->bins.marks);
+  SDL_free(rc->bins.tile_cmds);
+  if (rc->recording) { rencache_end_list(window_renderer); }
+  release_commands(window_renderer->command_buf, window_renderer->command_buf_idx);
+  window_renderer->command_buf_idx = 0;
+  release_commands(rc->prev_buf, rc->prev_buf_idx);
+  SDL_free(rc->prev_buf);
+  SDL_free(rc->moved_cmd);
+  SDL_free(rc);
+  window_renderer->cache = NULL;
 }
 
 
 void rencache_begin_frame(RenWindow *window_renderer) {
-  /* reset all cells if the screen width/height has changed */
+  /* glyphs drawn before the background thread was done were rasterized on
+     the spot, so the ones it finished don't change what was drawn */
+  ren_commit_prewarmed_glyphs();
+  ren_glyph_cache_tick();
+  RenCache *rc = window_renderer->cache;
+  if (!rc) {
+    rc = window_renderer->cache = SDL_calloc(1, sizeof(RenCache));
+    if (!rc) {
+      fprintf(stderr, "Warning: (" __FILE__ "): unable to allocate the render cache\n");
+      return;
+    }
+  }
+  /* reset all cells if the screen width/height or the cell size has changed */
   int w, h;
-  resize_issue = false;
+  rc->resize_issue = false;
+  rc->scroll_count = 0;
+  memset(&rc->frame_stats, 0, sizeof(rc->frame_stats));
+  ren_get_glyph_stats(&rc->frame_glyphs);
   ren_get_size(window_renderer, &w, &h);
-  if (screen_rect.width != w || h != screen_rect.height) {
-    screen_rect.width = w;
-    screen_rect.height = h;
-    rencache_invalidate();
+  int cell_size = rencache_max(cell_size_px / renwin_get_surface(window_renderer).scale, MIN_CELL_SIZE);
+  if (!rc->cells || rc->screen_rect.width != w || h != rc->screen_rect.height || rc->cell_size != cell_size) {
+    rc->screen_rect.width = w;
+    rc->screen_rect.height = h;
+    if (!resize_grid(rc, w, h, cell_size)) {
+      /* nothing can be drawn without a grid, try again next frame */
+      rc->resize_issue = true;
+    }
+  }
+  rc->last_clip_rect = rc->screen_rect;
+  rc->in_frame = true;
+}
+
+
+/* folds a command into the cells it touches, limited to the cells in `range`.
+** Where `bounds` only covers part of a cell, that part is folded in as well */
+static void update_overlapping_cells(RenCache *rc, uint64_t *cells, RenRect r, RenRect bounds, uint64_t h, RenRect range) {
+  const int cs = rc->cell_size;
+  int x1 = rencache_max(r.x / cs, range.x);
+  int y1 = rencache_max(r.y / cs, range.y);
+  int x2 = rencache_min((r.x + r.width) / cs, range.x + range.width - 1);
+  int y2 = rencache_min((r.y + r.height) / cs, range.y + range.height - 1);
+
+  for (int y = y1; y <= y2; y++) {
+    for (int x = x1; x <= x2; x++) {
+      RenRect cell = { x * cs, y * cs, cs, cs };
+      RenRect visible = intersect_rects(cell, bounds);
+      uint64_t ch = h;
+      if (visible.width != cs || visible.height != cs) {
+        ch ^= hash(&visible, sizeof(visible));
+      }
+      hash_cell(&cells[cell_idx(rc, x, y)], ch);
+    }
   }
-  last_clip_rect = screen_rect;
 }
 
 
-static void update_overlapping_cells(RenRect r, unsigned h) {
-  int x1 = r.x / CELL_SIZE;
-  int y1 = r.y / CELL_SIZE;
-  int x2 = (r.x + r.width) / CELL_SIZE;
-  int y2 = (r.y + r.height) / CELL_SIZE;
+/* folds a command of the previous frame into the cells it covers once moved */
+static void scroll_command(RenCache *rc, const ScrollRegion *sr, Command *cmd, RenRect cr, RenRect range) {
+  RenRect clip = { cr.x + sr->dx, cr.y + sr->dy, cr.width, cr.height };
+  clip = intersect_rects(clip, sr->rect);
+  RenRect r = { cmd->command[0].x + sr->dx, cmd->command[0].y + sr->dy, cmd->command[0].width, cmd->command[0].height };
+  r = intersect_rects(r, clip);
+  if (r.width <= 0 || r.height <= 0) { return; }
+  /* commands are hashed as a whole, so a moved copy is hashed, leaving the
+  ** previous frame and the display lists as they were drawn; tab stops are
+  ** relative to the start of the text and don't move */
+  if (!grow_array((void **) &rc->moved_cmd, &rc->moved_cmd_capacity, cmd->size, 1)) {
+    update_overlapping_cells(rc, rc->cells_prev, r, r, ~HASH_INITIAL, range);
+    return;
+  }
+  Command *moved = memcpy(rc->moved_cmd, cmd, cmd->size);
+  moved->command[0].x += sr->dx;
+  moved->command[0].y += sr->dy;
+  if (moved->type == DRAW_TEXT) {
+    ((DrawTextCommand *) moved->command)->text_x += sr->dx;
+  } else if (moved->type == DRAW_TEXT_RUNS) {
+    DrawTextRunsCommand *runs = (DrawTextRunsCommand *) moved->command;
+    for (uint32_t i = 0; i < runs->count; i++) { runs->runs[i].text_x += sr->dx; }
+  }
+  update_overlapping_cells(rc, rc->cells_prev, r, command_bounds(moved, r, clip), hash_command(moved), range);
+}
+
+
+/* rehashes the cells of a scrolled region from the previous frame's commands,
+** moved along with its pixels. Cells only partly covered by what was moved
+** can't be trusted and are always redrawn. */
+static void scroll_cells(RenCache *rc, const ScrollRegion *sr) {
+  const int cs = rc->cell_size;
+  RenRect moved = { sr->rect.x + sr->dx, sr->rect.y + sr->dy, sr->rect.width, sr->rect.height };
+  RenRect kept = intersect_rects(sr->rect, moved);
+  /* the cells that are entirely covered by the moved pixels, those on the
+  ** right and bottom edges of the screen only need to be covered up to it */
+  int x2 = kept.x + kept.width >= rc->screen_rect.width ? rc->cells_x : (kept.x + kept.width) / cs;
+  int y2 = kept.y + kept.height >= rc->screen_rect.height ? rc->cells_y : (kept.y + kept.height) / cs;
+  RenRect range = { (kept.x + cs - 1) / cs, (kept.y + cs - 1) / cs, 0, 0 };
+  range.width = rencache_max(0, x2 - range.x);
+  range.height = rencache_max(0, y2 - range.y);
+
+  for (int y = sr->rect.y / cs; y <= (sr->rect.y + sr->rect.height - 1) / cs; y++) {
+    for (int x = sr->rect.x / cs; x <= (sr->rect.x + sr->rect.width - 1) / cs; x++) {
+      int idx = cell_idx(rc, x, y);
+      bool inside = x >= range.x && x < range.x + range.width && y >= range.y && y < range.y + range.height;
+      rc->cells_prev[idx] = inside ? HASH_INITIAL : ~rc->cells[idx];
+    }
+  }
+  if (range.width == 0 || range.height == 0) { return; }
+
+  RenRect cr = rc->screen_rect;
+  for (size_t i = 0; i < rc->prev_buf_idx; i += ((Command *) (rc->prev_buf + i))->size) {
+    Command *cmd = (Command *) (rc->prev_buf + i);
+    if (cmd->type == SET_CLIP) {
+      cr = cmd->command[0];
+    } else if (cmd->type != DRAW_LIST) {
+      scroll_command(rc, sr, cmd, cr, range);
+    } else {
+      DrawListCommand *lcmd = (DrawListCommand *) cmd->command;
+      RenDisplayList *list = lcmd->list;
+      uint8_t *buf = list->buf;
+      size_t buf_idx = list->buf_idx;
+      if (lcmd->version == list->old_version) {
+        buf = list->old_buf;
+        buf_idx = list->old_buf_idx;
+      } else if (lcmd->version != list->version) {
+        /* recorded twice since, what it drew is gone */
+        RenRect r = { lcmd->rect.x + sr->dx, lcmd->rect.y + sr->dy, lcmd->rect.width, lcmd->rect.height };
+        update_overlapping_cells(rc, rc->cells_prev, r, r, ~HASH_INITIAL, range);
+        continue;
+      }
+      RenRect lcr = cr;
+      for (size_t j = 0; j < buf_idx; j += ((Command *) (buf + j))->size) {
+        Command *lc = (Command *) (buf + j);
+        if (lc->type == SET_CLIP) {
+          lcr = intersect_rects(lc->command[0], cr);
+        } else {
+          scroll_command(rc, sr, lc, lcr, range);
+        }
+      }
+    }
+  }
+}
+
+
+static void scroll_pixels(RenSurface *rs, const ScrollRegion *sr) {
+  SDL_Surface *surface = rs->surface;
+  const int scale = rs->scale;
+  const int bpp = SDL_BYTESPERPIXEL(surface->format);
+  const int dx = sr->dx * scale, dy = sr->dy * scale;
+  const int x = sr->rect.x * scale, y = sr->rect.y * scale;
+  const int rows = sr->rect.height * scale - abs(dy);
+  const size_t row_size = (size_t) (sr->rect.width * scale - abs(dx)) * bpp;
+  uint8_t *dst = (uint8_t *) surface->pixels + (y + rencache_max(dy, 0)) * surface->pitch + (x + rencache_max(dx, 0)) * bpp;
+  uint8_t *src = (uint8_t *) surface->pixels + (y + rencache_max(-dy, 0)) * surface->pitch + (x + rencache_max(-dx, 0)) * bpp;
+  /* go against the direction of the move so that no row is overwritten before it is copied */
+  int step = surface->pitch;
+  if (dy > 0) {
+    dst += (rows - 1) * surface->pitch;
+    src += (rows - 1) * surface->pitch;
+    step = -step;
+  }
+  for (int i = 0; i < rows; i++, dst += step, src += step) {
+    memmove(dst, src, row_size);
+  }
+}
+
 
+static void bin_command(RenCache *rc, Command *cmd, RenRect r, RenRect clip) {
+  CommandBins *bins = &rc->bins;
+  int x1 = r.x / rc->cell_size;
+  int y1 = r.y / rc->cell_size;
+  int x2 = (r.x + r.width) / rc->cell_size;
+  int y2 = (r.y + r.height) / rc->cell_size;
+  int entries = bins->entry_count + (x2 - x1 + 1) * (y2 - y1 + 1);
+
+  if (bins->overflow
+      || !grow_array((void **) &bins->cmds, &bins->cmd_capacity, bins->cmd_count + 1, sizeof(BinnedCommand))
+      || !grow_array((void **) &bins->entries, &bins->entry_capacity, entries, sizeof(BinEntry))) {
+    bins->overflow = true;
+    return;
+  }
+  int cmd_idx = bins->cmd_count++;
+  bins->cmds[cmd_idx] = (BinnedCommand) { cmd, clip };
   for (int y = y1; y <= y2; y++) {
     for (int x = x1; x <= x2; x++) {
-      int idx = cell_idx(x, y);
-      hash(&cells[idx], &h, sizeof(h));
+      int idx = cell_idx(rc, x, y);
+      bins->entries[bins->entry_count] = (BinEntry) { cmd_idx, bins->heads[idx] };
+      bins->heads[idx] = bins->entry_count++;
     }
   }
 }
 
 
-static void push_rect(RenRect r, int *count) {
-  /* try to merge with existing rectangle */
+static void reset_bins(RenCache *rc) {
+  memset(rc->bins.heads, 0xff, (size_t) rc->cells_x * rc->cells_y * sizeof(int));
+  rc->bins.cmd_count = 0;
+  rc->bins.entry_count = 0;
+  rc->bins.overflow = false;
+}
+
+
+/* collects the commands overlapping a tile (in cells), in the order they were issued */
+static void bin_tile_commands(RenCache *rc, RenRect t, int tile) {
+  CommandBins *bins = &rc->bins;
+  int start = bins->tile_starts[tile], count = start;
+  int lo = bins->cmd_count, hi = -1;
+  for (int y = t.y; y < t.y + t.height; y++) {
+    for (int x = t.x; x < t.x + t.width; x++) {
+      for (int e = bins->heads[cell_idx(rc, x, y)]; e >= 0; e = bins->entries[e].next) {
+        int c = bins->entries[e].cmd;
+        bins->marks[c >> 5] |= 1u << (c & 31);
+        lo = rencache_min(lo, c);
+        hi = rencache_max(hi, c);
+      }
+    }
+  }
+  for (int w = lo >> 5; w <= hi >> 5 && hi >= 0; w++) {
+    while (bins->marks[w]) {
+      bins->tile_cmds[count++] = (w << 5) + lowest_bit(bins->marks[w]);
+      bins->marks[w] &= bins->marks[w] - 1;
+    }
+  }
+  bins->tile_starts[tile + 1] = count;
+}
+
+
+/* the area in points of a rect in cells, cells on the edges are partly offscreen */
+static inline int cells_area(RenCache *rc, RenRect r) {
+  int w = rencache_min((r.x + r.width) * rc->cell_size, rc->screen_rect.width) - r.x * rc->cell_size;
+  int h = rencache_min((r.y + r.height) * rc->cell_size, rc->screen_rect.height) - r.y * rc->cell_size;
+  return w * h;
+}
+
+
+/* merges a run of changed cells into a rect right above it with the same columns,
+** which covers the same cells without any waste */
+static void push_rect(RenCache *rc, RenRect r, int *count) {
   for (int i = *count - 1; i >= 0; i--) {
-    RenRect *rp = &rect_buf[i];
-    if (rects_overlap(*rp, r)) {
-      *rp = merge_rects(*rp, r);
+    RenRect *rp = &rc->rect_buf[i];
+    if (rp->x == r.x && rp->width == r.width && rp->y + rp->height == r.y) {
+      rp->height += r.height;
       return;
     }
   }
-  /* couldn't merge with previous rectangle: push */
-  rect_buf[(*count)++] = r;
+  rc->rect_buf[(*count)++] = r;
+}
+
+
+/* repeatedly merges the two rects whose union covers the fewest clean points,
+** as long as that costs less than updating both separately */
+static void merge_rect_window(RenCache *rc, RenRect *rects, int *count) {
+  while (*count > 1) {
+    int best_i = -1, best_j = -1, best_waste = RECT_OVERHEAD;
+    for (int i = 0; i < *count; i++) {
+      int area_i = cells_area(rc, rects[i]);
+      for (int j = i + 1; j < *count; j++) {
+        int waste = cells_area(rc, merge_rects(rects[i], rects[j])) - area_i - cells_area(rc, rects[j]);
+        if (waste < best_waste) {
+          best_i = i;
+          best_j = j;
+          best_waste = waste;
+        }
+      }
+    }
+    if (best_i < 0) { break; }
+    rects[best_i] = merge_rects(rects[best_i], rects[best_j]);
+    rects[best_j] = rects[--(*count)];
+  }
+}
+
+
+static int compare_rect_rows(const void *a, const void *b) {
+  const RenRect *ra = a, *rb = b;
+  return ra->y != rb->y ? ra->y - rb->y : ra->x - rb->x;
+}
+
+
+/* merges the rects within windows of RECT_MERGE_WINDOW neighbours in row
+** order, over again while that still removes a good share of them, then all
+** of them together once they are few enough */
+static void merge_rects_by_cost(RenCache *rc, int *count) {
+  RenRect *rects = rc->rect_buf;
+  while (*count > RECT_MERGE_WINDOW) {
+    int before = *count, merged = 0;
+    qsort(rects, *count, sizeof(RenRect), compare_rect_rows);
+    for (int start = 0; start < before; start += RECT_MERGE_WINDOW) {
+      int n = rencache_min(RECT_MERGE_WINDOW, before - start);
+      merge_rect_window(rc, rects + start, &n);
+      memmove(rects + merged, rects + start, n * sizeof(RenRect));
+      merged += n;
+    }
+    *count = merged;
+    if (merged > before - before / 8) { return; }
+  }
+  merge_rect_window(rc, rects, count);
+}
+
+
+/* tiles must stay disjoint, so a run of changed cells is only merged with a
+** tile of the same width ending directly above it, and never across `band`
+** rows; `band_start` is the first tile pushed in the current band */
+static void push_tile(RenCache *rc, RenRect r, int band_start, int band, int *count) {
+  if (r.y % band != 0) {
+    for (int i = band_start; i < *count; i++) {
+      RenRect *tp = &rc->tile_buf[i];
+      if (tp->x == r.x && tp->width == r.width && tp->y + tp->height == r.y) {
+        tp->height++;
+        return;
+      }
+    }
+  }
+  rc->tile_buf[(*count)++] = r;
+}
+
+
+static void draw_command(RenSurface *rs, Command *cmd) {
+  DrawRectCommand *rcmd = (DrawRectCommand*)&cmd->command;
+  DrawTextCommand *tcmd = (DrawTextCommand*)&cmd->command;
+  DrawTextRunsCommand *rscmd = (DrawTextRunsCommand*)&cmd->command;
+  switch (cmd->type) {
+    case DRAW_RECT:
+      ren_draw_rect(rs, rcmd->rect, rcmd->color);
+      break;
+    case DRAW_OVERLAY:
+      if (((DrawOverlayCommand *) cmd->command)->visible) {
+        ren_draw_rect(rs, rcmd->rect, rcmd->color);
+      }
+      break;
+    case DRAW_TEXT:
+      ren_draw_text(rs, font_groups[tcmd->font_group].fonts, tcmd->text, tcmd->len, tcmd->text_x, tcmd->rect.y, tcmd->color, tcmd->tab, tcmd->tab_size);
+      break;
+    case DRAW_TEXT_RUNS: {
+      const char *text = (const char *) &rscmd->runs[rscmd->count];
+      for (uint32_t i = 0; i < rscmd->count; i++) {
+        TextRunEntry *run = &rscmd->runs[i];
+        ren_draw_text(rs, font_groups[run->font_group].fonts, text, run->len, run->text_x, rscmd->rect.y, run->color, run->tab, run->tab_size);
+        text += run->len;
+      }
+      break;
+    }
+    case DRAW_LIST: {
+      /* only reached when replaying every command, otherwise those of the list are binned */
+      RenDisplayList *list = ((DrawListCommand *) cmd->command)->list;
+      RenSurface inner = *rs;
+      for (size_t i = 0; i < list->buf_idx; i += ((Command *) (list->buf + i))->size) {
+        Command *lc = (Command *) (list->buf + i);
+        if (lc->type == SET_CLIP) {
+          inner.clip = intersect_rects(lc->command[0], rs->clip);
+        } else {
+          draw_command(&inner, lc);
+        }
+      }
+      break;
+    }
+    default:
+      break;
+  }
+}
+
+
+static void draw_tile(RenWindow *window_renderer, RenSurface rs, int tile) {
+  CommandBins *bins = &window_renderer->cache->bins;
+  RenRect r = window_renderer->cache->tile_buf[tile];
+  if (bins->overflow) {
+    /* we couldn't bin every command, replay all of them */
+    Command *cmd = NULL;
+    rs.clip = r;
+    while (next_command(window_renderer, &cmd)) {
+      if (cmd->type == SET_CLIP) {
+        rs.clip = intersect_rects(cmd->command[0], r);
+      } else {
+        draw_command(&rs, cmd);
+      }
+    }
+    return;
+  }
+  for (int i = bins->tile_starts[tile]; i < bins->tile_starts[tile + 1]; i++) {
+    BinnedCommand *bc = &bins->cmds[bins->tile_cmds[i]];
+    rs.clip = intersect_rects(bc->clip, r);
+    draw_command(&rs, bc->cmd);
+  }
+}
+
+
+static void run_job(RenderJob *job) {
+  int i;
+  while ((i = SDL_AddAtomicInt(&job->next_tile, 1)) < job->tile_count) {
+    draw_tile(job->window_renderer, job->rs, i);
+  }
+}
+
+
+static int worker_main(UNUSED void *data) {
+  unsigned generation = 0;
+  SDL_LockMutex(workers.mutex);
+  for (;;) {
+    while (!workers.quit && workers.generation == generation) {
+      SDL_WaitCondition(workers.start, workers.mutex);
+    }
+    if (workers.quit) { break; }
+    generation = workers.generation;
+    RenderJob *job = workers.job;
+    SDL_UnlockMutex(workers.mutex);
+    run_job(job);
+    SDL_LockMutex(workers.mutex);
+    if (--workers.busy == 0) {
+      SDL_SignalCondition(workers.done);
+    }
+  }
+  SDL_UnlockMutex(workers.mutex);
+  return 0;
+}
+
+
+static bool start_workers(void) {
+  if (workers.started) { return workers.count > 0; }
+  workers.started = true;
+  int count = rencache_min(SDL_GetNumLogicalCPUCores(), MAX_RENDER_THREADS) - 1;
+  if (count <= 0) { return false; }
+  workers.mutex = SDL_CreateMutex();
+  workers.start = SDL_CreateCondition();
+  workers.done = SDL_CreateCondition();
+  if (!workers.mutex || !workers.start || !workers.done) {
+    fprintf(stderr, "Warning: (" __FILE__ "): unable to create render threads: %s\n", SDL_GetError());
+    return false;
+  }
+  for (int i = 0; i < count; i++) {
+    workers.threads[i] = SDL_CreateThread(worker_main, "rencache", NULL);
+    if (!workers.threads[i]) { break; }
+    workers.count++;
+  }
+  return workers.count > 0;
+}
+
+
+void rencache_get_stats(RenWindow *window_renderer, RenCacheStats *stats) {
+  if (window_renderer && window_renderer->cache) {
+    *stats = window_renderer->cache->stats;
+  } else {
+    memset(stats, 0, sizeof(*stats));
+  }
+}
+
+
+void rencache_free(void) {
+  if (workers.count > 0) {
+    SDL_LockMutex(workers.mutex);
+    workers.quit = true;
+    SDL_BroadcastCondition(workers.start);
+    SDL_UnlockMutex(workers.mutex);
+    for (int i = 0; i < workers.count; i++) {
+      SDL_WaitThread(workers.threads[i], NULL);
+    }
+  }
+  SDL_DestroyCondition(workers.done);
+  SDL_DestroyCondition(workers.start);
+  SDL_DestroyMutex(workers.mutex);
+  memset(&workers, 0, sizeof(workers));
+  SDL_free(font_groups);
+  font_groups = NULL;
+  font_group_count = font_group_capacity = font_group_last = 0;
+  SDL_free(pending_runs);
+  pending_runs = NULL;
+  pending_run_capacity = 0;
+}
+
+
+static void load_glyphs(RenSurface *rs, Command *cmd) {
+  if (cmd->type == DRAW_TEXT) {
+    DrawTextCommand *tcmd = (DrawTextCommand*)&cmd->command;
+    ren_font_group_load_glyphs(rs, font_groups[tcmd->font_group].fonts, tcmd->text, tcmd->len, tcmd->text_x, tcmd->tab, tcmd->tab_size);
+  } else if (cmd->type == DRAW_TEXT_RUNS) {
+    DrawTextRunsCommand *rscmd = (DrawTextRunsCommand*)&cmd->command;
+    const char *text = (const char *) &rscmd->runs[rscmd->count];
+    for (uint32_t i = 0; i < rscmd->count; i++) {
+      TextRunEntry *run = &rscmd->runs[i];
+      ren_font_group_load_glyphs(rs, font_groups[run->font_group].fonts, text, run->len, run->text_x, run->tab, run->tab_size);
+      text += run->len;
+    }
+  } else if (cmd->type == DRAW_LIST) {
+    RenDisplayList *list = ((DrawListCommand *) cmd->command)->list;
+    for (size_t i = 0; i < list->buf_idx; i += ((Command *) (list->buf + i))->size) {
+      load_glyphs(rs, (Command *) (list->buf + i));
+    }
+  }
+}
+
+
+static void draw_tiles_parallel(RenWindow *window_renderer, RenSurface rs, int tile_count) {
+  /* the glyph cache is not thread safe: load everything the workers need
+  ** beforehand, so that they only ever read from it */
+  CommandBins *bins = &window_renderer->cache->bins;
+  if (bins->overflow) {
+    Command *cmd = NULL;
+    while (next_command(window_renderer, &cmd)) {
+      load_glyphs(&rs, cmd);
+    }
+  } else {
+    for (int i = 0; i < bins->tile_starts[tile_count]; i++) {
+      load_glyphs(&rs, bins->cmds[bins->tile_cmds[i]].cmd);
+    }
+  }
+
+  RenderJob job = { .window_renderer = window_renderer, .rs = rs, .tile_count = tile_count };
+  SDL_SetAtomicInt(&job.next_tile, 0);
+  SDL_LockMutex(workers.mutex);
+  workers.job = &job;
+  workers.busy = workers.count;
+  workers.generation++;
+  SDL_BroadcastCondition(workers.start);
+  SDL_UnlockMutex(workers.mutex);
+
+  /* this thread draws tiles as well while waiting */
+  run_job(&job);
+
+  SDL_LockMutex(workers.mutex);
+  while (workers.busy > 0) {
+    SDL_WaitCondition(workers.done, workers.mutex);
+  }
+  workers.job = NULL;
+  SDL_UnlockMutex(workers.mutex);
+}
+
+
+/* how far the glyphs of a text command can be drawn out of its rect */
+static int text_overhang(Command *cmd) {
+  if (cmd->type == DRAW_TEXT) {
+    return ren_font_group_get_overhang(font_groups[((DrawTextCommand *) cmd->command)->font_group].fonts);
+  }
+  int overhang = 0;
+  if (cmd->type == DRAW_TEXT_RUNS) {
+    DrawTextRunsCommand *rscmd = (DrawTextRunsCommand *) cmd->command;
+    for (uint32_t i = 0; i < rscmd->count; i++) {
+      overhang = rencache_max(overhang, ren_font_group_get_overhang(font_groups[rscmd->runs[i].font_group].fonts));
+    }
+  }
+  return overhang;
+}
+
+
+static void add_command(RenCache *rc, Command *cmd, uint64_t h, RenRect clip) {
+  RenRect r = intersect_rects(cmd->command[0], clip);
+  if (r.width == 0 || r.height == 0) { return; }
+  RenRect all_cells = { 0, 0, rc->cells_x, rc->cells_y };
+  update_overlapping_cells(rc, rc->cells, r, command_bounds(cmd, r, clip), h, all_cells);
+  /* text is replayed wherever its glyphs can reach, for the redrawn
+  ** background of a neighbouring cell not to cut through them */
+  int overhang = text_overhang(cmd);
+  if (overhang > 0) {
+    RenRect ink = cmd->command[0];
+    ink = (RenRect) { ink.x - overhang, ink.y - overhang, ink.width + 2 * overhang, ink.height + 2 * overhang };
+    r = intersect_rects(ink, clip);
+  }
+  bin_command(rc, cmd, r, clip);
+}
+
+
+static double seconds_since(Uint64 start) {
+  return (double) (SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+}
+
+
+static void finish_stats(RenCache *rc) {
+  RenGlyphStats glyphs;
+  ren_get_glyph_stats(&glyphs);
+  /* the totals may have wrapped around since the frame began */
+  rc->frame_stats.glyphs = (unsigned) glyphs.drawn - (unsigned) rc->frame_glyphs.drawn;
+  rc->frame_stats.glyph_misses = (unsigned) glyphs.misses - (unsigned) rc->frame_glyphs.misses;
+  rc->frame_stats.rasterizations = (unsigned) glyphs.rasterized - (unsigned) rc->frame_glyphs.rasterized;
+  rc->stats = rc->frame_stats;
 }
 
 
 void rencache_end_frame(RenWindow *window_renderer) {
+  RenCache *rc = window_renderer->cache;
+  if (rc && rc->recording) {
+    fprintf(stderr, "Warning: (" __FILE__ "): display list still recording at the end of the frame\n");
+    rencache_end_list(window_renderer);
+  }
+  if (rc) { rc->in_frame = false; }
+  if (!rc || !rc->cells) {
+    if (rc) {
+      rc->prev_valid = false;
+      finish_stats(rc);
+    }
+    release_commands(window_renderer->command_buf, window_renderer->command_buf_idx);
+    window_renderer->command_buf_idx = 0;
+    return;
+  }
+  CommandBins *bins = &rc->bins;
+  const int cell_size = rc->cell_size;
+  const RenRect screen_rect = rc->screen_rect;
+  Uint64 start = SDL_GetPerformanceCounter();
+
   /* update cells from commands */
   Command *cmd = NULL;
   RenRect cr = screen_rect;
+  reset_bins(rc);
   while (next_command(window_renderer, &cmd)) {
     /* cmd->command[0] should always be the Command rect */
-    if (cmd->type == SET_CLIP) { cr = cmd->command[0]; }
-    RenRect r = intersect_rects(cmd->command[0], cr);
-    if (r.width == 0 || r.height == 0) { continue; }
-    unsigned h = HASH_INITIAL;
-    hash(&h, cmd, cmd->size);
-    update_overlapping_cells(r, h);
+    if (cmd->type == SET_CLIP) {
+      cr = cmd->command[0];
+    } else if (cmd->type != DRAW_LIST) {
+      if (cmd->type == DRAW_OVERLAY) {
+        ((DrawOverlayCommand *) cmd->command)->visible = rc->overlays_visible;
+      }
+      /* hashed once, then folded into every cell it touches */
+      add_command(rc, cmd, hash_command(cmd), cr);
+    } else {
+      /* the commands of a list were hashed when it was recorded */
+      RenDisplayList *list = ((DrawListCommand *) cmd->command)->list;
+      RenRect lcr = cr;
+      int k = 0;
+      for (size_t i = 0; i < list->buf_idx; i += ((Command *) (list->buf + i))->size) {
+        Command *lc = (Command *) (list->buf + i);
+        if (lc->type == SET_CLIP) {
+          lcr = intersect_rects(lc->command[0], cr);
+        } else {
+          add_command(rc, lc, list->hashes[k++], lcr);
+        }
+      }
+    }
+  }
+
+  /* move the scrolled regions, their cells now compare against the moved pixels */
+  RenSurface rs = renwin_get_surface(window_renderer);
+  if (rc->prev_valid) {
+    for (int i = 0; i < rc->scroll_count; i++) {
+      scroll_cells(rc, &rc->scrolls[i]);
+      scroll_pixels(&rs, &rc->scrolls[i]);
+    }
+  } else {
+    rc->scroll_count = 0;
   }
 
-  /* push rects for all cells changed from last frame, reset cells */
-  int rect_count = 0;
-  int max_x = screen_rect.width / CELL_SIZE + 1;
-  int max_y = screen_rect.height / CELL_SIZE + 1;
+  /* find the runs of visible cells changed from last frame and reset cells;
+  ** each run is pushed both as a dirty rect and as a tile to redraw */
+  int rect_count = 0, tile_count = 0, changed_cells = 0;
+  int max_x = rc->cells_x;
+  int max_y = rc->cells_y;
+  int threads = 1 + workers.count;
+  int band = (max_y + threads - 1) / threads;
+  int band_start = 0;
   for (int y = 0; y < max_y; y++) {
-    for (int x = 0; x < max_x; x++) {
+    int run_start = -1;
+    if (y % band == 0) { band_start = tile_count; }
+    for (int x = 0; x <= max_x; x++) {
       /* compare previous and current cell for change */
-      int idx = cell_idx(x, y);
-      if (cells[idx] != cells_prev[idx]) {
-        push_rect((RenRect) { x, y, 1, 1 }, &rect_count);
+      int idx = cell_idx(rc, x, y);
+      bool changed = x < max_x && rc->cells[idx] != rc->cells_prev[idx];
+      if (changed) { changed_cells++; }
+      bool visible = x * cell_size < screen_rect.width && y * cell_size < screen_rect.height;
+      if (changed && visible) {
+        if (run_start < 0) { run_start = x; }
+      } else if (run_start >= 0) {
+        push_rect(rc, (RenRect) { run_start, y, x - run_start, 1 }, &rect_count);
+        push_tile(rc, (RenRect) { run_start, y, x - run_start, 1 }, band_start, band, &tile_count);
+        run_start = -1;
       }
-      cells_prev[idx] = HASH_INITIAL;
+      if (x < max_x) { rc->cells_prev[idx] = HASH_INITIAL; }
     }
   }
 
-  /* expand rects from cells to pixels */
+  /* collect the commands to replay for each tile */
+  int marks_capacity = bins->marks_capacity;
+  if (!bins->overflow
+      && grow_array((void **) &bins->marks, &bins->marks_capacity, bins->cmd_count / 32 + 1, sizeof(uint32_t))
+      && grow_array((void **) &bins->tile_cmds, &bins->tile_cmds_capacity, bins->entry_count, sizeof(int))) {
+    if (bins->marks_capacity != marks_capacity) {
+      memset(bins->marks, 0, bins->marks_capacity * sizeof(uint32_t));
+    }
+    bins->tile_starts[0] = 0;
+    for (int i = 0; i < tile_count; i++) {
+      bin_tile_commands(rc, rc->tile_buf[i], i);
+    }
+  } else {
+    bins->overflow = true;
+  }
+
+  merge_rects_by_cost(rc, &rect_count);
+
+  /* expand rects and tiles from cells to pixels */
   for (int i = 0; i < rect_count; i++) {
-    RenRect *r = &rect_buf[i];
-    r->x *= CELL_SIZE;
-    r->y *= CELL_SIZE;
-    r->width *= CELL_SIZE;
-    r->height *= CELL_SIZE;
+    RenRect *r = &rc->rect_buf[i];
+    r->x *= cell_size;
+    r->y *= cell_size;
+    r->width *= cell_size;
+    r->height *= cell_size;
+    *r = intersect_rects(*r, screen_rect);
+  }
+  for (int i = 0; i < tile_count; i++) {
+    RenRect *r = &rc->tile_buf[i];
+    r->x *= cell_size;
+    r->y *= cell_size;
+    r->width *= cell_size;
+    r->height *= cell_size;
     *r = intersect_rects(*r, screen_rect);
   }
 
-  RenSurface rs = renwin_get_surface(window_renderer);
-  /* redraw updated regions */
-  for (int i = 0; i < rect_count; i++) {
-    /* draw */
-    RenRect r = rect_buf[i];
-    ren_set_clip_rect(window_renderer, r);
+  /* the scrolled regions were moved as a whole, so they are presented as such */
+  for (int i = 0; i < rc->scroll_count; i++) {
+    rc->rect_buf[rect_count++] = rc->scrolls[i].rect;
+  }
 
-    cmd = NULL;
-    while (next_command(window_renderer, &cmd)) {
-      SetClipCommand *ccmd = (SetClipCommand*)&cmd->command;
-      DrawRectCommand *rcmd = (DrawRectCommand*)&cmd->command;
-      DrawTextCommand *tcmd = (DrawTextCommand*)&cmd->command;
-      switch (cmd->type) {
-        case SET_CLIP:
-          ren_set_clip_rect(window_renderer, intersect_rects(ccmd->rect, r));
-          break;
-        case DRAW_RECT:
-          ren_draw_rect(&rs, rcmd->rect, rcmd->color);
-          break;
-        case DRAW_TEXT:
-          ren_font_group_set_tab_size(tcmd->fonts, tcmd->tab_size);
-          ren_draw_text(&rs, tcmd->fonts, tcmd->text, tcmd->len, tcmd->text_x, tcmd->rect.y, tcmd->color, tcmd->tab);
-          break;
-      }
+  rc->frame_stats.dirty_cells = changed_cells;
+  rc->frame_stats.rects = rect_count;
+  for (int i = 0; i < tile_count; i++) {
+    rc->frame_stats.pixels += (int64_t) rect_area(rc->tile_buf[i]) * rs.scale * rs.scale;
+  }
+  rc->frame_stats.hash_time = seconds_since(start);
+  start = SDL_GetPerformanceCounter();
+
+  /* redraw updated regions */
+  if (tile_count > 1 && changed_cells >= PARALLEL_MIN_CELLS && start_workers()) {
+    draw_tiles_parallel(window_renderer, rs, tile_count);
+  } else {
+    for (int i = 0; i < tile_count; i++) {
+      draw_tile(window_renderer, rs, i);
     }
+  }
 
-    if (show_debug) {
+  if (show_debug) {
+    for (int i = 0; i < tile_count; i++) {
       RenColor color = { rand(), rand(), rand(), 50 };
-      ren_draw_rect(&rs, r, color);
+      rs.clip = rc->tile_buf[i];
+      ren_draw_rect(&rs, rc->tile_buf[i], color);
     }
   }
 
+  rc->frame_stats.draw_time = seconds_since(start);
+  start = SDL_GetPerformanceCounter();
+
   /* update dirty rects */
   if (rect_count > 0) {
-    ren_update_rects(window_renderer, rect_buf, rect_count);
+    ren_update_rects(window_renderer, rc->rect_buf, rect_count);
   }
+  rc->frame_stats.present_time = seconds_since(start);
+  finish_stats(rc);
 
   /* swap cell buffer and reset */
-  unsigned *tmp = cells;
-  cells = cells_prev;
-  cells_prev = tmp;
+  uint64_t *tmp = rc->cells;
+  rc->cells = rc->cells_prev;
+  rc->cells_prev = tmp;
+
+  /* keep this frame's commands around, the previous ones are written over */
+  release_commands(rc->prev_buf, rc->prev_buf_idx);
+  uint8_t *buf = rc->prev_buf;
+  size_t buf_size = rc->prev_buf_size;
+  rc->prev_buf = window_renderer->command_buf;
+  rc->prev_buf_size = window_renderer->command_buf_size;
+  rc->prev_buf_idx = window_renderer->command_buf_idx;
+  rc->prev_valid = true;
+  window_renderer->command_buf = buf;
+  window_renderer->command_buf_size = buf_size;
   window_renderer->command_buf_idx = 0;
 }
 
+
+/* replays the commands of the last frame inside of `r` */
+static void redraw_last_frame(RenCache *rc, RenSurface rs, RenRect r) {
+  rs.clip = r;
+  for (size_t i = 0; i < rc->prev_buf_idx; i += ((Command *) (rc->prev_buf + i))->size) {
+    Command *cmd = (Command *) (rc->prev_buf + i);
+    if (cmd->type == SET_CLIP) {
+      rs.clip = intersect_rects(cmd->command[0], r);
+    } else if (rects_overlap(cmd->command[0], rs.clip)) {
+      draw_command(&rs, cmd);
+    }
+  }
+}
+
+
+bool rencache_show_overlays(RenWindow *window_renderer, bool visible) {
+  RenCache *rc = window_renderer ? window_renderer->cache : NULL;
+  if (!rc) { return false; }
+  if (rc->in_frame) {
+    rc->overlays_visible = visible;
+    return true;
+  }
+  if (!rc->prev_valid || !rc->cells_prev) { return false; }
+
+  /* find the cells under the overlays that change; their hashes no longer
+  ** match their pixels, so they are redrawn on the next frame too */
+  const int cs = rc->cell_size;
+  const int capacity = rc->cells_x * rc->cells_y + MAX_SCROLLS;
+  int overlay_count = 0, rect_count = 0;
+  RenRect cr = rc->screen_rect;
+  for (size_t i = 0; i < rc->prev_buf_idx; i += ((Command *) (rc->prev_buf + i))->size) {
+    Command *cmd = (Command *) (rc->prev_buf + i);
+    if (cmd->type == SET_CLIP) { cr = cmd->command[0]; continue; }
+    if (cmd->type != DRAW_OVERLAY) { continue; }
+    overlay_count++;
+    DrawOverlayCommand *ocmd = (DrawOverlayCommand *) cmd->command;
+    RenRect r = intersect_rects(ocmd->rect, cr);
+    if (ocmd->visible == visible || r.width <= 0 || r.height <= 0) { continue; }
+    ocmd->visible = visible;
+    int x1 = r.x / cs, y1 = r.y / cs;
+    int x2 = rencache_min((r.x + r.width) / cs, rc->cells_x - 1);
+    int y2 = rencache_min((r.y + r.height) / cs, rc->cells_y - 1);
+    for (int y = y1; y <= y2; y++) {
+      for (int x = x1; x <= x2; x++) {
+        rc->cells_prev[cell_idx(rc, x, y)] = UINT64_MAX;
+      }
+    }
+    RenRect cells = intersect_rects((RenRect) { x1 * cs, y1 * cs, (x2 - x1 + 1) * cs, (y2 - y1 + 1) * cs }, rc->screen_rect);
+    if (rect_count < capacity) {
+      rc->rect_buf[rect_count++] = cells;
+    } else {
+      rc->rect_buf[rect_count - 1] = merge_rects(rc->rect_buf[rect_count - 1], cells);
+    }
+  }
+  rc->overlays_visible = visible;
+  if (rect_count > 0) {
+    RenSurface rs = renwin_get_surface(window_renderer);
+    for (int i = 0; i < rect_count; i++) {
+      redraw_last_frame(rc, rs, rc->rect_buf[i]);
+    }
+    ren_update_rects(window_renderer, rc->rect_buf, rect_count);
+  }
+  return overlay_count > 0;
+}
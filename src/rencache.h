@@ -5,12 +5,52 @@
 #include <lua.h>
 #include "renderer.h"
 
+typedef struct RenDisplayList RenDisplayList;
+
+/* a run of text of rencache_draw_text_runs() */
+typedef struct {
+  RenFont *fonts[FONT_FALLBACK_MAX];
+  const char *text;
+  size_t len;
+  RenColor color;
+} RenTextRun;
+
+/* what the last frame of a window cost, times are in seconds */
+typedef struct {
+  int commands;         /* pushed, including those recorded into lists */
+  size_t command_bytes; /* taken by those commands */
+  int dirty_cells;
+  int rects;            /* presented, after merging the dirty cells */
+  int64_t pixels;       /* redrawn, in surface pixels */
+  int glyphs;           /* drawn */
+  int glyph_misses;     /* glyph lookups that had to go through FreeType */
+  int rasterizations;   /* glyph bitmaps rendered by FreeType */
+  double hash_time, draw_time, present_time;
+} RenCacheStats;
+
 void  rencache_show_debug(bool enable);
+void  rencache_set_cell_size(int size);
 void  rencache_set_clip_rect(RenWindow *window_renderer, RenRect rect);
+void  rencache_scroll_rect(RenWindow *window_renderer, RenRect rect, int dx, int dy);
 void  rencache_draw_rect(RenWindow *window_renderer, RenRect rect, RenColor color);
+/* a rect that is only drawn while the window's overlays are visible */
+void  rencache_draw_overlay(RenWindow *window_renderer, RenRect rect, RenColor color);
 double rencache_draw_text(RenWindow *window_renderer, RenFont **font, const char *text, size_t len, double x, int y, RenColor color, RenTab tab);
+/* draws runs one after the other from `x`, until one ends after `max_x` */
+double rencache_draw_text_runs(RenWindow *window_renderer, RenTextRun *runs, int count, double x, int y, double max_x, RenTab tab);
+RenDisplayList *rencache_list_new(void);
+void  rencache_list_free(RenDisplayList *list);
+bool  rencache_begin_list(RenWindow *window_renderer, RenDisplayList *list);
+void  rencache_end_list(RenWindow *window_renderer);
+void  rencache_draw_list(RenWindow *window_renderer, RenDisplayList *list);
 void  rencache_invalidate(void);
 void  rencache_begin_frame(RenWindow *window_renderer);
 void  rencache_end_frame(RenWindow *window_renderer);
+/* shows or hides the overlays; outside of a frame, the cells under those of
+** the last frame are repainted right away. Returns false if there were none */
+bool  rencache_show_overlays(RenWindow *window_renderer, bool visible);
+void  rencache_get_stats(RenWindow *window_renderer, RenCacheStats *stats);
+void  rencache_free_window(RenWindow *window_renderer);
+void  rencache_free(void);
 
 #endif
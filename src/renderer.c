@@ -10,8 +10,19 @@
 #include FT_OUTLINE_H
 #include FT_SYSTEM_H
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <utime.h>
+#endif
+
 #include "renderer.h"
 #include "renwindow.h"
+#include "rencache.h"
 
 // uncomment the line below for more debugging information through printf
 // #define RENDERER_DEBUG
@@ -20,9 +31,11 @@ static RenWindow **window_list = NULL;
 static RenWindow *target_window = NULL;
 static size_t window_count = 0;
 
-// draw_rect_surface is used as a 1x1 surface to simplify ren_draw_rect with blending
-static SDL_Surface *draw_rect_surface = NULL;
 static FT_Library library = NULL;
+// glyphs are drawn from several threads, so these are updated atomically
+static struct { SDL_AtomicInt drawn, misses, rasterized; } glyph_stats;
+// surfaces used since the last ren_glyph_cache_tick() are never evicted
+static unsigned int glyph_frame = 1;
 
 #define check_alloc(P) _check_alloc(P, __FILE__, __LINE__)
 static void* _check_alloc(void *ptr, const char *const file, size_t ln) {
@@ -50,6 +63,8 @@ static const char *const get_ft_error(FT_Error err) {
 // some padding to add to atlas surface to store more glyphs
 #define FONT_HEIGHT_OVERFLOW_PX 0
 #define FONT_WIDTH_OVERFLOW_PX 9
+// default budget for the glyph cache of a font, in bytes
+#define GLYPH_CACHE_BUDGET (32 * 1024 * 1024)
 
 // maximum unicode codepoint supported (https://stackoverflow.com/a/52203901)
 #define MAX_UNICODE 0x10FFFF
@@ -77,7 +92,9 @@ typedef enum {
 typedef enum {
   EGlyphNone = 0,             // glyph is not loaded
   EGlyphXAdvance = (1 << 0L), // xadvance is loaded
-  EGlyphBitmap = (1 << 1L)    // bitmap is loaded
+  EGlyphBitmap = (1 << 1L),   // bitmap is loaded
+  EGlyphNoBitmap = (1 << 2L), // bitmap is empty or cannot be rendered
+  EGlyphPending = (1 << 3L)   // bitmap is being rendered in the background
 } ERenGlyphFlags;
 
 // metrics for a loaded glyph
@@ -98,6 +115,8 @@ typedef struct {
 // a bitmap atlas with a fixed width, each surface acting as a bump allocator
 typedef struct {
   SDL_Surface **surfaces;
+  // the glyph frame in which each surface was last used, see ren_glyph_cache_tick()
+  unsigned int *last_used;
   unsigned int width, nsurface;
 } GlyphAtlas;
 
@@ -109,24 +128,69 @@ typedef struct {
   GlyphAtlas *atlas[EGlyphFormatSize];
   size_t natlas[EGlyphFormatSize];
   size_t bytesize;
+  // once bytesize reaches the budget, surfaces are reused instead of allocated (0 for no limit)
+  size_t budget;
+  unsigned int evictions;
 } GlyphMap;
 
+// a file mapped in memory, read only
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE file, mapping;
+#endif
+} MappedFile;
+
+// glyphs rasterized in previous sessions, see font_open_disk_cache()
+typedef struct {
+  char *path;
+  MappedFile file;
+  // record offsets sorted by glyph_id << 2 | bitmap_idx
+  struct { uint32_t key, offset; } *index;
+  size_t count;
+  // glyphs were rasterized with FreeType since the file was mapped
+  bool dirty;
+} GlyphDiskCache;
+
+// a font file mapped in memory, shared by the fonts loaded from it
+typedef struct FontFile {
+  struct FontFile *next;
+  MappedFile map;
+  int refs;
+  char path[];
+} FontFile;
+
 typedef struct RenFont {
+  // the font holding the face and the glyphs, see font_shared_acquire()
+  struct RenFont *shared;
+  // for shared fonts: the next one in the registry, and the number of handles on it
+  struct RenFont *next;
+  int refs;
   FT_Face face;
+  FontFile *file; // NULL if the file is read through a SDL stream
   CharMap charmap;
   GlyphMap glyphs;
+  GlyphDiskCache disk;
 #ifdef LITE_USE_SDL_RENDERER
   int scale;
 #endif
   float size, space_advance;
   unsigned short baseline, height, tab_size;
   unsigned short underline_thickness;
+  unsigned short overhang; // how far glyphs can be drawn out of the box of their text
   ERenFontAntialiasing antialiasing;
   ERenFontHinting hinting;
   unsigned char style;
   char path[];
 } RenFont;
 
+// the shared fonts of a group of handles, see font_shared_acquire()
+static void font_group_shared(RenFont **handles, RenFont **fonts) {
+  for (int i = 0; i < FONT_FALLBACK_MAX; i++)
+    fonts[i] = (i == 0 || fonts[i - 1]) && handles[i] ? handles[i]->shared : NULL;
+}
+
 #ifdef LITE_USE_SDL_RENDERER
 void update_font_scale(RenWindow *window_renderer, RenFont **fonts) {
   if (window_renderer == NULL) return;
@@ -169,10 +233,12 @@ static int font_set_render_options(RenFont* font) {
     return FT_RENDER_MODE_MONO;
   if (font->antialiasing == FONT_ANTIALIASING_SUBPIXEL) {
     unsigned char weights[] = { 0x10, 0x40, 0x70, 0x40, 0x10 } ;
+    // the face may belong to the library of the prewarming thread
+    FT_Library face_library = font->face->glyph->library;
     switch (font->hinting) {
-      case FONT_HINTING_NONE: FT_Library_SetLcdFilter(library, FT_LCD_FILTER_NONE); break;
+      case FONT_HINTING_NONE: FT_Library_SetLcdFilter(face_library, FT_LCD_FILTER_NONE); break;
       case FONT_HINTING_SLIGHT:
-      case FONT_HINTING_FULL: FT_Library_SetLcdFilterWeights(library, weights); break;
+      case FONT_HINTING_FULL: FT_Library_SetLcdFilterWeights(face_library, weights); break;
     }
     return FT_RENDER_MODE_LCD;
   } else {
@@ -224,9 +290,37 @@ static inline SDL_PixelFormat glyphformat_to_pixelformat(ERenGlyphFormat format,
   }
 }
 
-static SDL_Surface *font_allocate_glyph_surface(RenFont *font, FT_GlyphSlot slot, int bitmap_idx, GlyphMetric *metric) {
+// clears the least recently used surface of an atlas that can hold a glyph,
+// and forgets the glyphs it had so that they get rasterized again when needed
+static int font_evict_glyph_surface(RenFont *font, ERenGlyphFormat glyph_format, int atlas_idx, unsigned int rows) {
+  GlyphAtlas *atlas = &font->glyphs.atlas[glyph_format][atlas_idx];
+  int lru = -1;
+  for (int i = 0; i < (int) atlas->nsurface; i++) {
+    if (atlas->last_used[i] == glyph_frame || (unsigned int) atlas->surfaces[i]->h < rows) continue;
+    if (lru < 0 || atlas->last_used[i] < atlas->last_used[lru]) lru = i;
+  }
+  if (lru < 0) return -1;
+  for (int bitmap_idx = 0; bitmap_idx < FONT_BITMAP_COUNT(font); bitmap_idx++) {
+    for (int row = 0; row < GLYPHMAP_ROW; row++) {
+      if (!font->glyphs.metrics[bitmap_idx][row]) continue;
+      for (unsigned int col = 0; col < GLYPHMAP_COL; col++) {
+        GlyphMetric *m = &font->glyphs.metrics[bitmap_idx][row][col];
+        if ((m->flags & EGlyphBitmap) && m->format == glyph_format && m->atlas_idx == atlas_idx && m->surface_idx == lru) {
+          m->flags &= ~EGlyphBitmap;
+          m->y0 = 0;
+        }
+      }
+    }
+  }
+  SDL_Surface *surface = atlas->surfaces[lru];
+  SDL_SetPointerProperty(SDL_GetSurfaceProperties(surface), "metric", NULL);
+  memset(surface->pixels, 0, (size_t) surface->pitch * surface->h);
+  font->glyphs.evictions++;
+  return lru;
+}
+
+static SDL_Surface *font_allocate_glyph_surface(RenFont *font, ERenGlyphFormat glyph_format, unsigned int rows, GlyphMetric *metric) {
   // get an atlas with the correct width
-  ERenGlyphFormat glyph_format = SLOT_BITMAP_TYPE(slot->bitmap);
   int atlas_idx = -1;
   for (int i = 0; i < font->glyphs.natlas[glyph_format]; i++) {
     if (font->glyphs.atlas[glyph_format][i].width >= metric->x1) {
@@ -240,7 +334,7 @@ static SDL_Surface *font_allocate_glyph_surface(RenFont *font, FT_GlyphSlot slot
     );
     font->glyphs.atlas[glyph_format][font->glyphs.natlas[glyph_format]] = (GlyphAtlas) {
       .width = metric->x1 + FONT_WIDTH_OVERFLOW_PX, .nsurface = 0,
-      .surfaces = NULL,
+      .surfaces = NULL, .last_used = NULL,
     };
     font->glyphs.bytesize += sizeof(GlyphAtlas);
     atlas_idx = font->glyphs.natlas[glyph_format]++;
@@ -261,20 +355,26 @@ static SDL_Surface *font_allocate_glyph_surface(RenFont *font, FT_GlyphSlot slot
       min_waste = new_min_waste;
     }
   }
+  int h = FONT_HEIGHT_OVERFLOW_PX + (double) font->face->size->metrics.height / 64.0f;
+  if (h <= FONT_HEIGHT_OVERFLOW_PX) h += rows;
+  if (h <= FONT_HEIGHT_OVERFLOW_PX) h += font->size;
+  int depth = 0;
+  SDL_PixelFormat format = glyphformat_to_pixelformat(glyph_format, &depth);
+  size_t surface_bytes = sizeof(SDL_Surface *) + sizeof(SDL_Surface) + sizeof(unsigned int) + atlas->width * GLYPHS_PER_ATLAS * h * (depth / 8);
+  if (surface_idx < 0 && font->glyphs.budget && font->glyphs.bytesize + surface_bytes > font->glyphs.budget)
+    surface_idx = font_evict_glyph_surface(font, glyph_format, atlas_idx, rows);
   if (surface_idx < 0) {
     // allocate a new surface array, and a surface
-    int h = FONT_HEIGHT_OVERFLOW_PX + (double) font->face->size->metrics.height / 64.0f;
-    if (h <= FONT_HEIGHT_OVERFLOW_PX) h += slot->bitmap.rows;
-    if (h <= FONT_HEIGHT_OVERFLOW_PX) h += font->size;
-    int depth = 0;
-    SDL_PixelFormat format = glyphformat_to_pixelformat(glyph_format, &depth);
     atlas->surfaces = check_alloc(SDL_realloc(atlas->surfaces, sizeof(SDL_Surface *) * (atlas->nsurface + 1)));
+    atlas->last_used = check_alloc(SDL_realloc(atlas->last_used, sizeof(unsigned int) * (atlas->nsurface + 1)));
     atlas->surfaces[atlas->nsurface] = check_alloc(SDL_CreateSurface(atlas->width, GLYPHS_PER_ATLAS * h, format));
     userdata = SDL_GetSurfaceProperties(atlas->surfaces[atlas->nsurface]);
     SDL_SetPointerProperty(userdata, "metric", NULL);
     surface_idx = atlas->nsurface++;
-    font->glyphs.bytesize += (sizeof(SDL_Surface *) + sizeof(SDL_Surface) + atlas->width * GLYPHS_PER_ATLAS * h * glyph_format);
+    font->glyphs.bytesize += surface_bytes;
   }
+  // fonts rasterized by the prewarming thread have no budget, and don't read the frame
+  atlas->last_used[surface_idx] = font->glyphs.budget ? glyph_frame : 0;
   metric->surface_idx = surface_idx;
   userdata = SDL_GetSurfaceProperties(atlas->surfaces[surface_idx]);
   if (SDL_HasProperty(userdata, "metric")) {
@@ -285,6 +385,381 @@ static SDL_Surface *font_allocate_glyph_surface(RenFont *font, FT_GlyphSlot slot
   return atlas->surfaces[surface_idx];
 }
 
+// copies a glyph rendered elsewhere (in the background, or in a previous
+// session) into an atlas, the metric must have its size and format set
+static SDL_Surface *font_store_glyph_bitmap(RenFont *font, GlyphMetric *metric, const uint8_t *pixels, int pitch) {
+  unsigned int rows = metric->y1;
+  metric->y0 = 0;
+  SDL_Surface *surface = font_allocate_glyph_surface(font, metric->format, rows, metric);
+  // glyphs are stacked vertically in the atlases, so whole lines can be copied
+  int line_size = pitch < surface->pitch ? pitch : surface->pitch;
+  for (unsigned int line = 0; line < rows; ++line)
+    memcpy((uint8_t *) surface->pixels + surface->pitch * (metric->y0 + line), pixels + (size_t) pitch * line, line_size);
+  metric->flags |= EGlyphBitmap;
+  return surface;
+}
+
+/******************* Disk cache **********************/
+// Glyph metrics and bitmaps are saved to a file per font and rendering
+// settings when the font is freed, and mapped in when it is loaded again, so
+// that FreeType is only used for glyphs that were never rasterized before.
+// The file is a header, the font path, and a record for every glyph and
+// bitmap index followed by its pixels, padded to 4 bytes. Files are saved by
+// the prewarming thread, which then prunes the directory: files of fonts that
+// changed or are gone are removed, then the least recently used ones until
+// the directory fits in GLYPH_CACHE_DIR_BUDGET.
+#define GLYPH_CACHE_MAGIC "LXGC"
+#define GLYPH_CACHE_VERSION 1
+#define GLYPH_CACHE_SUFFIX ".glyphs"
+#define GLYPH_CACHE_DIR_BUDGET (64 * 1024 * 1024)
+// sanity limits for the records of a file
+#define GLYPH_CACHE_MAX_SIZE 4096
+
+typedef struct {
+  char magic[4];
+  uint32_t version, freetype_version;
+  float pixel_size;
+  uint8_t antialiasing, hinting, style, bitmaps;
+  int64_t font_size, font_mtime;
+  uint32_t path_len, count;
+} GlyphCacheHeader;
+
+typedef struct {
+  uint32_t glyph_id;
+  uint8_t bitmap_idx, flags, format, unused;
+  float xadvance;
+  int32_t bitmap_left, bitmap_top;
+  uint32_t x1, rows, pitch;
+} GlyphCacheRecord;
+
+static char *glyph_cache_dir = NULL;
+
+static bool map_file(const char *path, MappedFile *map) {
+  memset(map, 0, sizeof(*map));
+#ifdef _WIN32
+  int len = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+  WCHAR *wpath = len ? SDL_malloc(sizeof(WCHAR) * len) : NULL;
+  if (!wpath) return false;
+  MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, len);
+  map->file = CreateFileW(wpath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  SDL_free(wpath);
+  if (map->file == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(map->file, &size) || size.QuadPart == 0
+      || !(map->mapping = CreateFileMappingW(map->file, NULL, PAGE_READONLY, 0, 0, NULL))) {
+    CloseHandle(map->file);
+    return false;
+  }
+  if (!(map->data = MapViewOfFile(map->mapping, FILE_MAP_READ, 0, 0, 0))) {
+    CloseHandle(map->mapping);
+    CloseHandle(map->file);
+    return false;
+  }
+  map->size = (size_t) size.QuadPart;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) return false;
+  struct stat info;
+  void *data = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && info.st_size > 0)
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED) return false;
+  map->data = data;
+  map->size = info.st_size;
+#endif
+  return true;
+}
+
+// marks a file as used now, for the LRU pruning of the cache directory
+static void touch_file(const char *path) {
+#ifdef _WIN32
+  int len = MultiByteToWideChar(CP_UTF8, 0, path, -1, NULL, 0);
+  WCHAR *wpath = len ? SDL_malloc(sizeof(WCHAR) * len) : NULL;
+  if (!wpath) return;
+  MultiByteToWideChar(CP_UTF8, 0, path, -1, wpath, len);
+  HANDLE file = CreateFileW(wpath, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  SDL_free(wpath);
+  if (file == INVALID_HANDLE_VALUE) return;
+  FILETIME now;
+  GetSystemTimeAsFileTime(&now);
+  SetFileTime(file, NULL, NULL, &now);
+  CloseHandle(file);
+#else
+  utime(path, NULL);
+#endif
+}
+
+static void unmap_file(MappedFile *map) {
+  if (!map->data) return;
+#ifdef _WIN32
+  UnmapViewOfFile(map->data);
+  CloseHandle(map->mapping);
+  CloseHandle(map->file);
+#else
+  munmap((void *) map->data, map->size);
+#endif
+  memset(map, 0, sizeof(*map));
+}
+
+static size_t glyph_cache_record_size(const GlyphCacheRecord *record) {
+  return sizeof(GlyphCacheRecord) + (((size_t) record->rows * record->pitch + 3) & ~(size_t) 3);
+}
+
+static size_t glyph_cache_header(RenFont *font, GlyphCacheHeader *header) {
+  SDL_PathInfo info = { 0 };
+  SDL_GetPathInfo(font->path, &info);
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, GLYPH_CACHE_MAGIC, 4);
+  header->version = GLYPH_CACHE_VERSION;
+  header->freetype_version = FREETYPE_MAJOR * 10000 + FREETYPE_MINOR * 100 + FREETYPE_PATCH;
+  header->pixel_size = font->size;
+#ifdef LITE_USE_SDL_RENDERER
+  header->pixel_size *= font->scale;
+#endif
+  header->antialiasing = font->antialiasing;
+  header->hinting = font->hinting;
+  header->style = font->style;
+  header->bitmaps = FONT_BITMAP_COUNT(font);
+  header->font_size = info.size;
+  header->font_mtime = info.modify_time;
+  header->path_len = strlen(font->path);
+  return sizeof(GlyphCacheHeader) + ((header->path_len + 3) & ~3);
+}
+
+static int glyph_cache_compare(const void *a, const void *b) {
+  uint32_t ka = *(const uint32_t *) a, kb = *(const uint32_t *) b;
+  return ka < kb ? -1 : ka > kb;
+}
+
+static const GlyphCacheRecord *font_disk_glyph(RenFont *font, unsigned int glyph_id, unsigned int bitmap_idx) {
+  uint32_t key = glyph_id << 2 | bitmap_idx;
+  size_t lo = 0, hi = font->disk.count;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (font->disk.index[mid].key < key) lo = mid + 1;
+    else hi = mid;
+  }
+  if (lo == font->disk.count || font->disk.index[lo].key != key) return NULL;
+  return (const GlyphCacheRecord *) (font->disk.file.data + font->disk.index[lo].offset);
+}
+
+// maps the glyphs saved for this font and its current settings, if any
+static void font_open_disk_cache(RenFont *font) {
+  if (!glyph_cache_dir) return;
+  GlyphCacheHeader header;
+  size_t offset = glyph_cache_header(font, &header);
+  uint64_t hash = 14695981039346656037ULL;
+  const uint8_t *bytes = (const uint8_t *) &header;
+  for (size_t i = 0; i < offsetof(GlyphCacheHeader, count); i++) hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  for (size_t i = 0; i < header.path_len; i++) hash = (hash ^ (uint8_t) font->path[i]) * 1099511628211ULL;
+  font->disk.path = check_alloc(SDL_malloc(strlen(glyph_cache_dir) + 32));
+  sprintf(font->disk.path, "%s/%016llx" GLYPH_CACHE_SUFFIX, glyph_cache_dir, (unsigned long long) hash);
+
+  MappedFile *file = &font->disk.file;
+  if (!map_file(font->disk.path, file)) return;
+  const GlyphCacheHeader *saved = (const GlyphCacheHeader *) file->data;
+  if (file->size < offset || file->size > UINT32_MAX
+      || memcmp(saved, &header, offsetof(GlyphCacheHeader, count)) != 0
+      || memcmp(file->data + sizeof(GlyphCacheHeader), font->path, header.path_len) != 0)
+    goto invalid;
+  font->disk.index = check_alloc(SDL_malloc(sizeof(*font->disk.index) * (saved->count ? saved->count : 1)));
+  for (uint32_t i = 0; i < saved->count; i++) {
+    const GlyphCacheRecord *record = (const GlyphCacheRecord *) (file->data + offset);
+    if (file->size - offset < sizeof(GlyphCacheRecord) || record->bitmap_idx >= header.bitmaps
+        || record->format >= EGlyphFormatSize || record->glyph_id >= MAX_GLYPHS
+        || record->x1 > GLYPH_CACHE_MAX_SIZE || record->rows > GLYPH_CACHE_MAX_SIZE || record->pitch > GLYPH_CACHE_MAX_SIZE * 3
+        || file->size - offset < glyph_cache_record_size(record))
+      goto invalid;
+    font->disk.index[i].key = record->glyph_id << 2 | record->bitmap_idx;
+    font->disk.index[i].offset = offset;
+    offset += glyph_cache_record_size(record);
+  }
+  font->disk.count = saved->count;
+  qsort(font->disk.index, font->disk.count, sizeof(*font->disk.index), glyph_cache_compare);
+  touch_file(font->disk.path);
+  return;
+
+invalid:
+  fprintf(stderr, "Warning: (" __FILE__ "): ignoring invalid glyph cache %s\n", font->disk.path);
+  SDL_free(font->disk.index);
+  font->disk.index = NULL;
+  unmap_file(file);
+}
+
+static bool glyph_cache_write_record(SDL_IOStream *out, const GlyphCacheRecord *record, const uint8_t *pixels, size_t pitch) {
+  static const uint8_t padding[4] = { 0 };
+  size_t size = (size_t) record->rows * record->pitch;
+  if (SDL_WriteIO(out, record, sizeof(*record)) != sizeof(*record)) return false;
+  for (unsigned int line = 0; line < record->rows; line++) {
+    if (SDL_WriteIO(out, pixels + pitch * line, record->pitch) != record->pitch) return false;
+  }
+  return SDL_WriteIO(out, padding, ((size + 3) & ~(size_t) 3) - size) == ((size + 3) & ~(size_t) 3) - size;
+}
+
+// writes the glyphs in memory, along with the saved ones that aren't
+static bool font_save_disk_cache(RenFont *font, const char *path) {
+  GlyphCacheHeader header;
+  size_t offset = glyph_cache_header(font, &header);
+  SDL_IOStream *out = SDL_IOFromFile(path, "wb");
+  if (!out) return false;
+  bool ok = SDL_WriteIO(out, &header, sizeof(header)) == sizeof(header)
+    && SDL_WriteIO(out, font->path, header.path_len) == header.path_len
+    && SDL_WriteIO(out, "\0\0\0", offset - sizeof(header) - header.path_len) == offset - sizeof(header) - header.path_len;
+  for (int bitmap_idx = 0; ok && bitmap_idx < FONT_BITMAP_COUNT(font); bitmap_idx++) {
+    for (unsigned int glyph_id = 0; ok && glyph_id < MAX_GLYPHS; glyph_id++) {
+      int row = glyph_id / GLYPHMAP_COL, col = glyph_id - (row * GLYPHMAP_COL);
+      GlyphMetric *metric = font->glyphs.metrics[bitmap_idx][row] ? &font->glyphs.metrics[bitmap_idx][row][col] : NULL;
+      const GlyphCacheRecord *saved = font_disk_glyph(font, glyph_id, bitmap_idx);
+      bool loaded = metric && (metric->flags & EGlyphXAdvance);
+      // keep the saved bitmaps of glyphs that were evicted, or not drawn in this session
+      if (saved && !(loaded && (metric->flags & (EGlyphBitmap | EGlyphNoBitmap)))) {
+        ok = glyph_cache_write_record(out, saved, (const uint8_t *) (saved + 1), saved->pitch);
+        header.count++;
+      } else if (loaded) {
+        GlyphCacheRecord record = {
+          .glyph_id = glyph_id, .bitmap_idx = bitmap_idx, .xadvance = metric->xadvance,
+          .flags = metric->flags & (EGlyphXAdvance | EGlyphBitmap | EGlyphNoBitmap)
+        };
+        const uint8_t *pixels = NULL;
+        size_t pitch = 0;
+        if (metric->flags & EGlyphBitmap) {
+          SDL_Surface *surface = font->glyphs.atlas[metric->format][metric->atlas_idx].surfaces[metric->surface_idx];
+          int depth = 0;
+          glyphformat_to_pixelformat(metric->format, &depth);
+          record.format = metric->format;
+          record.bitmap_left = metric->bitmap_left;
+          record.bitmap_top = metric->bitmap_top;
+          record.x1 = metric->x1;
+          record.rows = metric->y1 - metric->y0;
+          record.pitch = metric->x1 * (depth / 8);
+          if (record.pitch > (uint32_t) surface->pitch) record.pitch = surface->pitch;
+          pixels = (const uint8_t *) surface->pixels + (size_t) surface->pitch * metric->y0;
+          pitch = surface->pitch;
+        }
+        ok = glyph_cache_write_record(out, &record, pixels, pitch);
+        header.count++;
+      }
+    }
+  }
+  ok = ok && SDL_SeekIO(out, 0, SDL_IO_SEEK_SET) == 0 && SDL_WriteIO(out, &header, sizeof(header)) == sizeof(header);
+  return SDL_CloseIO(out) && ok;
+}
+
+// replaces the cache file with the saved glyphs and the ones rasterized since
+// it was opened; the saved glyphs can't be read anymore afterwards
+static void font_write_disk_cache(RenFont *font) {
+  // write to a temporary file first, as the old one is still mapped
+  char *tmp_path = check_alloc(SDL_malloc(strlen(font->disk.path) + 5));
+  sprintf(tmp_path, "%s.tmp", font->disk.path);
+  bool saved = font_save_disk_cache(font, tmp_path);
+  unmap_file(&font->disk.file);
+  if (!saved || !SDL_RenamePath(tmp_path, font->disk.path)) {
+    fprintf(stderr, "Warning: (" __FILE__ "): unable to save the glyph cache %s\n", font->disk.path);
+    SDL_RemovePath(tmp_path);
+  }
+  SDL_free(tmp_path);
+}
+
+static void font_free_disk_cache(RenFont *font) {
+  unmap_file(&font->disk.file);
+  SDL_free(font->disk.index);
+  SDL_free(font->disk.path);
+  memset(&font->disk, 0, sizeof(font->disk));
+}
+
+typedef struct {
+  char *path;
+  Uint64 size;
+  SDL_Time used;
+} GlyphCacheFile;
+
+typedef struct {
+  GlyphCacheFile *files;
+  int count, capacity;
+} GlyphCacheDir;
+
+// true if the file was saved by this version for the current font file
+static bool glyph_cache_file_valid(const char *path) {
+  GlyphCacheHeader header;
+  SDL_IOStream *in = SDL_IOFromFile(path, "rb");
+  if (!in) return false;
+  bool valid = SDL_ReadIO(in, &header, sizeof(header)) == sizeof(header)
+    && memcmp(header.magic, GLYPH_CACHE_MAGIC, 4) == 0
+    && header.version == GLYPH_CACHE_VERSION
+    && header.freetype_version == FREETYPE_MAJOR * 10000 + FREETYPE_MINOR * 100 + FREETYPE_PATCH
+    && header.path_len > 0 && header.path_len < 4096;
+  char *font_path = valid ? check_alloc(SDL_malloc(header.path_len + 1)) : NULL;
+  if (valid && SDL_ReadIO(in, font_path, header.path_len) == header.path_len) {
+    SDL_PathInfo info;
+    font_path[header.path_len] = '\0';
+    valid = SDL_GetPathInfo(font_path, &info)
+      && (int64_t) info.size == header.font_size && info.modify_time == header.font_mtime;
+  } else {
+    valid = false;
+  }
+  SDL_free(font_path);
+  SDL_CloseIO(in);
+  return valid;
+}
+
+static SDL_EnumerationResult glyph_cache_list_file(void *userdata, const char *dirname, const char *fname) {
+  GlyphCacheDir *dir = userdata;
+  size_t len = strlen(fname), suffix_len = strlen(GLYPH_CACHE_SUFFIX);
+  if (len <= suffix_len || strcmp(fname + len - suffix_len, GLYPH_CACHE_SUFFIX) != 0)
+    return SDL_ENUM_CONTINUE;
+  // dirname ends with a path separator
+  char *path = check_alloc(SDL_malloc(strlen(dirname) + len + 1));
+  sprintf(path, "%s%s", dirname, fname);
+  SDL_PathInfo info;
+  if (!SDL_GetPathInfo(path, &info) || info.type != SDL_PATHTYPE_FILE) {
+    SDL_free(path);
+    return SDL_ENUM_CONTINUE;
+  }
+  if (dir->count == dir->capacity) {
+    dir->capacity = dir->capacity ? dir->capacity * 2 : 16;
+    dir->files = check_alloc(SDL_realloc(dir->files, sizeof(GlyphCacheFile) * dir->capacity));
+  }
+  dir->files[dir->count++] = (GlyphCacheFile) { path, info.size, info.modify_time };
+  return SDL_ENUM_CONTINUE;
+}
+
+static int glyph_cache_compare_used(const void *a, const void *b) {
+  SDL_Time ua = ((const GlyphCacheFile *) a)->used, ub = ((const GlyphCacheFile *) b)->used;
+  return ua > ub ? -1 : ua < ub;
+}
+
+// removes the files that can't be used anymore, then the least recently used
+// ones past the budget of the directory
+static void glyph_cache_prune(const char *path) {
+  // the directory of a cache file, which is named by a 16 digits hash
+  size_t dir_len = strlen(path) - 17 - strlen(GLYPH_CACHE_SUFFIX);
+  char *dirname = check_alloc(SDL_malloc(dir_len + 1));
+  memcpy(dirname, path, dir_len);
+  dirname[dir_len] = '\0';
+  GlyphCacheDir dir = { 0 };
+  SDL_EnumerateDirectory(dirname, glyph_cache_list_file, &dir);
+  qsort(dir.files, dir.count, sizeof(GlyphCacheFile), glyph_cache_compare_used);
+  Uint64 total = 0;
+  for (int i = 0; i < dir.count; i++) {
+    GlyphCacheFile *file = &dir.files[i];
+    bool keep = strcmp(file->path, path) == 0
+      || (total + file->size <= GLYPH_CACHE_DIR_BUDGET && glyph_cache_file_valid(file->path));
+    if (keep)
+      total += file->size;
+    else
+      SDL_RemovePath(file->path);
+    SDL_free(file->path);
+  }
+  SDL_free(dir.files);
+  SDL_free(dirname);
+}
+
+void ren_set_glyph_cache_dir(const char *dir) {
+  SDL_free(glyph_cache_dir);
+  glyph_cache_dir = dir ? check_alloc(SDL_strdup(dir)) : NULL;
+}
+
 static GlyphMetric *font_load_glyph_metric(RenFont *font, unsigned int glyph_id, unsigned int bitmap_idx) {
   unsigned int load_option = font_set_load_options(font);
   int row = glyph_id / GLYPHMAP_COL, col = glyph_id - (row * GLYPHMAP_COL);
@@ -292,11 +767,20 @@ static GlyphMetric *font_load_glyph_metric(RenFont *font, unsigned int glyph_id,
 
   // we set all 3 subpixel bitmaps at once, so if either of them are missing we should load it with freetype
   if (!font->glyphs.metrics[0][row] || !(font->glyphs.metrics[0][row][col].flags & EGlyphXAdvance)) {
-    // load the font without hinting to fix an issue with monospaced fonts,
-    // because freetype doesn't report the correct LSB and RSB delta. Transformation & subpixel positioning don't affect
-    // the xadvance, so we can save some time by not doing this step multiple times
-    if (FT_Load_Glyph(font->face, glyph_id, (load_option | FT_LOAD_BITMAP_METRICS_ONLY | FT_LOAD_NO_HINTING) & ~FT_LOAD_FORCE_AUTOHINT) != 0)
-      return NULL;
+    const GlyphCacheRecord *saved = font_disk_glyph(font, glyph_id, 0);
+    float xadvance;
+    if (saved && (saved->flags & EGlyphXAdvance)) {
+      xadvance = saved->xadvance;
+    } else {
+      // load the font without hinting to fix an issue with monospaced fonts,
+      // because freetype doesn't report the correct LSB and RSB delta. Transformation & subpixel positioning don't affect
+      // the xadvance, so we can save some time by not doing this step multiple times
+      SDL_AddAtomicInt(&glyph_stats.misses, 1);
+      if (FT_Load_Glyph(font->face, glyph_id, (load_option | FT_LOAD_BITMAP_METRICS_ONLY | FT_LOAD_NO_HINTING) & ~FT_LOAD_FORCE_AUTOHINT) != 0)
+        return NULL;
+      xadvance = font->face->glyph->advance.x / 64.0f;
+      font->disk.dirty = true;
+    }
     for (int i = 0; i < bitmaps; i++) {
       // save the metrics for all subpixel indexes
       if (!font->glyphs.metrics[i][row]) {
@@ -305,31 +789,60 @@ static GlyphMetric *font_load_glyph_metric(RenFont *font, unsigned int glyph_id,
       }
       GlyphMetric *metric = &font->glyphs.metrics[i][row][col];
       metric->flags |= EGlyphXAdvance;
-      metric->xadvance = font->face->glyph->advance.x / 64.0f;
+      metric->xadvance = xadvance;
     }
   }
   return &font->glyphs.metrics[bitmap_idx][row][col];
 }
 
-static SDL_Surface *font_load_glyph_bitmap(RenFont *font, unsigned int glyph_id, unsigned int bitmap_idx) {
-  GlyphMetric *metric = font_load_glyph_metric(font, glyph_id, bitmap_idx);
-  if (!metric) return NULL;
-  if (metric->flags & EGlyphBitmap) return font->glyphs.atlas[metric->format][metric->atlas_idx].surfaces[metric->surface_idx];
+static SDL_Surface *font_get_glyph_bitmap(RenFont *font, unsigned int glyph_id, unsigned int bitmap_idx, GlyphMetric *metric) {
+  if (metric->flags & EGlyphBitmap) {
+    GlyphAtlas *atlas = &font->glyphs.atlas[metric->format][metric->atlas_idx];
+    // glyphs drawn from several threads are all loaded beforehand, so this is only written on the main thread
+    if (font->glyphs.budget && atlas->last_used[metric->surface_idx] != glyph_frame)
+      atlas->last_used[metric->surface_idx] = glyph_frame;
+    return atlas->surfaces[metric->surface_idx];
+  }
+  // remember glyphs without a bitmap, so we don't go through freetype again for every whitespace
+  if (metric->flags & EGlyphNoBitmap) return NULL;
+  // needed before the prewarming thread is done with it, the thread's bitmap is dropped on commit
+  metric->flags &= ~EGlyphPending;
+
+  const GlyphCacheRecord *saved = font_disk_glyph(font, glyph_id, bitmap_idx);
+  if (saved && (saved->flags & EGlyphNoBitmap)) {
+    metric->flags |= EGlyphNoBitmap;
+    return NULL;
+  }
+  if (saved && (saved->flags & EGlyphBitmap)) {
+    metric->x1 = saved->x1;
+    metric->y1 = saved->rows;
+    metric->bitmap_left = saved->bitmap_left;
+    metric->bitmap_top = saved->bitmap_top;
+    metric->format = saved->format;
+    return font_store_glyph_bitmap(font, metric, (const uint8_t *) (saved + 1), saved->pitch);
+  }
+  font->disk.dirty = true;
 
   // render the glyph for a bitmap_idx
   unsigned int load_option = font_set_load_options(font), render_option = font_set_render_options(font);
   FT_GlyphSlot slot = font->face->glyph;
+  SDL_AddAtomicInt(&glyph_stats.misses, 1);
+  SDL_AddAtomicInt(&glyph_stats.rasterized, 1);
   if (FT_Load_Glyph(font->face, glyph_id, load_option | FT_LOAD_BITMAP_METRICS_ONLY) != 0
       || font_set_style(&slot->outline, bitmap_idx * (64 / SUBPIXEL_BITMAPS_CACHED), font->style) != 0
-      || FT_Render_Glyph(slot, render_option) != 0)
+      || FT_Render_Glyph(slot, render_option) != 0) {
+    metric->flags |= EGlyphNoBitmap;
     return NULL;
+  }
 
   // if this bitmap is empty, or has a format we don't support, just store the xadvance
   if (!slot->bitmap.width || !slot->bitmap.rows || !slot->bitmap.buffer ||
       (slot->bitmap.pixel_mode != FT_PIXEL_MODE_MONO
         && slot->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY
-        && slot->bitmap.pixel_mode != FT_PIXEL_MODE_LCD))
+        && slot->bitmap.pixel_mode != FT_PIXEL_MODE_LCD)) {
+    metric->flags |= EGlyphNoBitmap;
     return NULL;
+  }
 
   unsigned int glyph_width = slot->bitmap.width / FONT_BITMAP_COUNT(font);
   // FT_PIXEL_MODE_MONO uses 1 bit per pixel packed bitmap
@@ -343,7 +856,7 @@ static SDL_Surface *font_load_glyph_bitmap(RenFont *font, unsigned int glyph_id,
   metric->format = SLOT_BITMAP_TYPE(slot->bitmap);
 
   // find the best surface to copy the glyph over, and copy it
-  SDL_Surface *surface = font_allocate_glyph_surface(font, slot, bitmap_idx, metric);
+  SDL_Surface *surface = font_allocate_glyph_surface(font, metric->format, slot->bitmap.rows, metric);
   uint8_t* pixels = surface->pixels;
   for (unsigned int line = 0; line < slot->bitmap.rows; ++line) {
     int target_offset = surface->pitch * (line + metric->y0); // x0 is always assumed to be 0
@@ -361,6 +874,11 @@ static SDL_Surface *font_load_glyph_bitmap(RenFont *font, unsigned int glyph_id,
   return surface;
 }
 
+static SDL_Surface *font_load_glyph_bitmap(RenFont *font, unsigned int glyph_id, unsigned int bitmap_idx) {
+  GlyphMetric *metric = font_load_glyph_metric(font, glyph_id, bitmap_idx);
+  return metric ? font_get_glyph_bitmap(font, glyph_id, bitmap_idx, metric) : NULL;
+}
+
 // https://en.wikipedia.org/wiki/Whitespace_character
 static inline int is_whitespace(unsigned int codepoint) {
   switch (codepoint) {
@@ -369,26 +887,37 @@ static inline int is_whitespace(unsigned int codepoint) {
   return (codepoint >= 0x9 && codepoint <= 0xD) || (codepoint >= 0x2000 && codepoint <= 0x200A);
 }
 
-static RenFont *font_group_get_glyph(RenFont **fonts, unsigned int codepoint, int subpixel_idx, SDL_Surface **surface, GlyphMetric **metric) {
-  if (subpixel_idx < 0) subpixel_idx += SUBPIXEL_BITMAPS_CACHED;
+// finds the font of the group and the glyph ID used to draw a codepoint
+static RenFont *font_group_find_glyph(RenFont **fonts, unsigned int codepoint, unsigned int *glyph_id) {
   RenFont *font = NULL;
-  unsigned int glyph_id = 0;
   for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; i++) {
-    font = fonts[i]; glyph_id = font_get_glyph_id(fonts[i], codepoint);
+    font = fonts[i]; *glyph_id = font_get_glyph_id(fonts[i], codepoint);
     // use the first font that has representation for the glyph ID, but for whitespaces always use the first font
-    if (glyph_id || is_whitespace(codepoint)) break;
+    if (*glyph_id || is_whitespace(codepoint)) break;
   }
   // load the glyph if it is not loaded
-  subpixel_idx = FONT_IS_SUBPIXEL(font) ? subpixel_idx : 0;
-  GlyphMetric *m = font_load_glyph_metric(font, glyph_id, subpixel_idx);
+  GlyphMetric *m = font_load_glyph_metric(font, *glyph_id, 0);
   // try the box drawing character (0x25A1) if the requested codepoint is not a whitespace, and we cannot load the .notdef glyph
   if ((!m || !m->flags) && codepoint != 0x25A1 && !is_whitespace(codepoint))
-    return font_group_get_glyph(fonts, 0x25A1, subpixel_idx, surface, metric);
+    return font_group_find_glyph(fonts, 0x25A1, glyph_id);
+  return font;
+}
+
+static RenFont *font_get_glyph(RenFont *font, unsigned int glyph_id, int subpixel_idx, SDL_Surface **surface, GlyphMetric **metric) {
+  if (subpixel_idx < 0) subpixel_idx += SUBPIXEL_BITMAPS_CACHED;
+  subpixel_idx = FONT_IS_SUBPIXEL(font) ? subpixel_idx : 0;
+  GlyphMetric *m = font_load_glyph_metric(font, glyph_id, subpixel_idx);
   if (metric && m) *metric = m;
-  if (surface && m) *surface = font_load_glyph_bitmap(font, glyph_id, subpixel_idx);
+  if (surface && m) *surface = font_get_glyph_bitmap(font, glyph_id, subpixel_idx, m);
   return font;
 }
 
+static RenFont *font_group_get_glyph(RenFont **fonts, unsigned int codepoint, int subpixel_idx, SDL_Surface **surface, GlyphMetric **metric) {
+  unsigned int glyph_id = 0;
+  RenFont *font = font_group_find_glyph(fonts, codepoint, &glyph_id);
+  return font_get_glyph(font, glyph_id, subpixel_idx, surface, metric);
+}
+
 static void font_clear_glyph_cache(RenFont* font) {
   for (int glyph_format_idx = 0; glyph_format_idx < EGlyphFormatSize; glyph_format_idx++) {
     for (int atlas_idx = 0; atlas_idx < font->glyphs.natlas[glyph_format_idx]; atlas_idx++) {
@@ -397,6 +926,7 @@ static void font_clear_glyph_cache(RenFont* font) {
         SDL_DestroySurface(atlas->surfaces[surface_idx]);
       }
       SDL_free(atlas->surfaces);
+      SDL_free(atlas->last_used);
     }
     SDL_free(font->glyphs.atlas[glyph_format_idx]);
     font->glyphs.atlas[glyph_format_idx] = NULL;
@@ -412,6 +942,333 @@ static void font_clear_glyph_cache(RenFont* font) {
   font->glyphs.bytesize = 0;
 }
 
+/******************* Glyph groups **********************/
+// Most of the text in an editor is made of the first few Unicode blocks, so
+// what their codepoints resolve to in a font group (the font, the glyph ID and
+// the metrics for every subpixel index) is kept in a flat table per group,
+// which turns resolving them into a single lookup. Like text runs, the tables
+// are only filled on the main thread, drawing only reads them.
+#define GLYPH_GROUP_CODEPOINTS 0x800
+#define GLYPH_GROUP_MAX 64
+
+typedef struct {
+  RenFont *font; // NULL until the codepoint is resolved
+  unsigned int glyph_id;
+  GlyphMetric *metrics[SUBPIXEL_BITMAPS_CACHED];
+} GroupGlyph;
+
+typedef struct GlyphGroup {
+  struct GlyphGroup *next;
+  RenFont *fonts[FONT_FALLBACK_MAX];
+  GroupGlyph glyphs[GLYPH_GROUP_CODEPOINTS];
+} GlyphGroup;
+
+static struct {
+  // most recently used first
+  GlyphGroup *first;
+  int count;
+} glyph_groups;
+
+static bool glyph_group_matches(const GlyphGroup *group, RenFont **fonts) {
+  for (int i = 0; i < FONT_FALLBACK_MAX; i++) {
+    if (group->fonts[i] != fonts[i]) return false;
+    if (!fonts[i]) break;
+  }
+  return true;
+}
+
+// finds the table of a font group, creating it if `create` is set (on the main thread only)
+static GlyphGroup *glyph_group_find(RenFont **fonts, bool create) {
+  GlyphGroup **slot = &glyph_groups.first, **last = NULL;
+  for (; *slot; last = slot, slot = &(*slot)->next) {
+    GlyphGroup *group = *slot;
+    if (!glyph_group_matches(group, fonts)) continue;
+    if (create && slot != &glyph_groups.first) {
+      *slot = group->next;
+      group->next = glyph_groups.first;
+      glyph_groups.first = group;
+    }
+    return group;
+  }
+  if (!create) return NULL;
+  GlyphGroup *group;
+  if (glyph_groups.count >= GLYPH_GROUP_MAX) {
+    // reuse the least recently used table
+    group = *last;
+    *last = NULL;
+    memset(group, 0, sizeof(GlyphGroup));
+  } else {
+    group = check_alloc(SDL_calloc(1, sizeof(GlyphGroup)));
+    glyph_groups.count++;
+  }
+  for (int i = 0; i < FONT_FALLBACK_MAX; i++)
+    group->fonts[i] = i == 0 || group->fonts[i - 1] ? fonts[i] : NULL;
+  group->next = glyph_groups.first;
+  glyph_groups.first = group;
+  return group;
+}
+
+// returns how a codepoint resolves in the group, resolving it first if `fill` is set
+static const GroupGlyph *glyph_group_get(GlyphGroup *group, RenFont **fonts, unsigned int codepoint, bool fill) {
+  if (!group || codepoint >= GLYPH_GROUP_CODEPOINTS) return NULL;
+  GroupGlyph *glyph = &group->glyphs[codepoint];
+  if (glyph->font || !fill) return glyph->font ? glyph : NULL;
+  unsigned int glyph_id = 0;
+  RenFont *font = font_group_find_glyph(fonts, codepoint, &glyph_id);
+  if (!font_load_glyph_metric(font, glyph_id, 0)) return NULL;
+  // the metrics of all subpixel indexes are loaded at once, and are the same one without subpixel antialiasing
+  for (int i = 0; i < SUBPIXEL_BITMAPS_CACHED; i++)
+    glyph->metrics[i] = font_load_glyph_metric(font, glyph_id, FONT_IS_SUBPIXEL(font) ? i : 0);
+  glyph->glyph_id = glyph_id;
+  glyph->font = font;
+  return glyph;
+}
+
+static RenFont *group_glyph_load(const GroupGlyph *glyph, int subpixel_idx, SDL_Surface **surface, GlyphMetric **metric) {
+  if (subpixel_idx < 0) subpixel_idx += SUBPIXEL_BITMAPS_CACHED;
+  GlyphMetric *m = glyph->metrics[subpixel_idx];
+  if (metric) *metric = m;
+  if (surface) *surface = font_get_glyph_bitmap(glyph->font, glyph->glyph_id, FONT_IS_SUBPIXEL(glyph->font) ? subpixel_idx : 0, m);
+  return glyph->font;
+}
+
+// drops the tables of the groups using a font (e.g. when it is freed or resized), or all of them for NULL
+static void glyph_group_drop(RenFont *font) {
+  for (GlyphGroup **slot = &glyph_groups.first; *slot;) {
+    GlyphGroup *group = *slot;
+    bool uses_font = !font;
+    for (int i = 0; i < FONT_FALLBACK_MAX && group->fonts[i] && !uses_font; i++)
+      uses_font = group->fonts[i] == font;
+    if (!uses_font) {
+      slot = &group->next;
+      continue;
+    }
+    *slot = group->next;
+    glyph_groups.count--;
+    SDL_free(group);
+  }
+}
+
+/******************* Text runs **********************/
+// Measuring and drawing text resolve every codepoint to a font of the group
+// and a glyph ID, which goes through the charmap and the fallback fonts. The
+// same short runs of text are measured and drawn every frame, so resolved runs
+// are kept in a LRU cache keyed by the font group, the tab settings and the
+// text. Runs are only added and reordered while measuring text, which happens
+// on the main thread; drawing (which may happen on several threads) only looks
+// them up.
+#define TEXT_RUN_CACHE_SIZE 4096
+#define TEXT_RUN_BUCKETS 8192
+// longer runs are rarely drawn twice, and aren't cached
+#define TEXT_RUN_MAX_LEN 256
+
+typedef struct {
+  RenFont *font;
+  unsigned int glyph_id, codepoint;
+} RunGlyph;
+
+typedef struct TextRun {
+  struct TextRun *next_in_bucket, *prev, *next;
+  uint64_t hash;
+  RenFont *fonts[FONT_FALLBACK_MAX];
+  // the tab settings are only part of the key if the text has a tab
+  double tab_offset;
+  int tab_size;
+  double width;
+  size_t len;
+  char *text;
+  int nglyph;
+  RunGlyph glyphs[];
+} TextRun;
+
+typedef struct {
+  RenFont **fonts;
+  const char *text;
+  size_t len;
+  double tab_offset;
+  int tab_size;
+  uint64_t hash;
+} TextRunKey;
+
+static struct {
+  TextRun *buckets[TEXT_RUN_BUCKETS];
+  // most and least recently used runs
+  TextRun *first, *last;
+  int count;
+} text_runs;
+
+static inline uint64_t text_run_hash_bytes(uint64_t h, const void *data, size_t len) {
+  const unsigned char *bytes = data;
+  for (size_t i = 0; i < len; i++)
+    h = (h ^ bytes[i]) * 1099511628211ULL;
+  return h;
+}
+
+static TextRunKey text_run_key(RenFont **fonts, const char *text, size_t len, RenTab tab, int tab_size) {
+  TextRunKey key = { fonts, text, len, 0, 0, text_run_hash_bytes(14695981039346656037ULL, text, len) };
+  if (memchr(text, '\t', len)) {
+    key.tab_offset = tab.offset;
+    key.tab_size = tab_size;
+  }
+  for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; i++)
+    key.hash = text_run_hash_bytes(key.hash, &fonts[i], sizeof(RenFont *));
+  key.hash = text_run_hash_bytes(key.hash, &key.tab_offset, sizeof(double));
+  key.hash = text_run_hash_bytes(key.hash, &key.tab_size, sizeof(int));
+  return key;
+}
+
+static bool text_run_matches(const TextRun *run, const TextRunKey *key) {
+  // the tab offset is compared bitwise, as it is NaN for fixed tabs
+  if (run->hash != key->hash || run->len != key->len || run->tab_size != key->tab_size
+      || memcmp(&run->tab_offset, &key->tab_offset, sizeof(double)) != 0)
+    return false;
+  for (int i = 0; i < FONT_FALLBACK_MAX; i++) {
+    if (run->fonts[i] != key->fonts[i]) return false;
+    if (!key->fonts[i]) break;
+  }
+  return memcmp(run->text, key->text, key->len) == 0;
+}
+
+static TextRun *text_run_find(const TextRunKey *key) {
+  for (TextRun *run = text_runs.buckets[key->hash % TEXT_RUN_BUCKETS]; run; run = run->next_in_bucket) {
+    if (text_run_matches(run, key)) return run;
+  }
+  return NULL;
+}
+
+static void text_run_unlink(TextRun *run) {
+  if (run->prev) run->prev->next = run->next;
+  else text_runs.first = run->next;
+  if (run->next) run->next->prev = run->prev;
+  else text_runs.last = run->prev;
+}
+
+static void text_run_push_front(TextRun *run) {
+  run->prev = NULL;
+  run->next = text_runs.first;
+  if (text_runs.first) text_runs.first->prev = run;
+  else text_runs.last = run;
+  text_runs.first = run;
+}
+
+static void text_run_remove(TextRun *run) {
+  TextRun **slot = &text_runs.buckets[run->hash % TEXT_RUN_BUCKETS];
+  while (*slot != run) slot = &(*slot)->next_in_bucket;
+  *slot = run->next_in_bucket;
+  text_run_unlink(run);
+  text_runs.count--;
+  SDL_free(run);
+}
+
+static TextRun *text_run_add(const TextRunKey *key, const RunGlyph *glyphs, int nglyph, double width) {
+  if (text_runs.count >= TEXT_RUN_CACHE_SIZE)
+    text_run_remove(text_runs.last);
+  TextRun *run = check_alloc(SDL_malloc(sizeof(TextRun) + sizeof(RunGlyph) * nglyph + key->len));
+  run->hash = key->hash;
+  for (int i = 0; i < FONT_FALLBACK_MAX; i++)
+    run->fonts[i] = i == 0 || run->fonts[i - 1] ? key->fonts[i] : NULL;
+  run->tab_offset = key->tab_offset;
+  run->tab_size = key->tab_size;
+  run->width = width;
+  run->len = key->len;
+  run->text = (char *) &run->glyphs[nglyph];
+  memcpy(run->text, key->text, key->len);
+  run->nglyph = nglyph;
+  memcpy(run->glyphs, glyphs, sizeof(RunGlyph) * nglyph);
+  TextRun **bucket = &text_runs.buckets[key->hash % TEXT_RUN_BUCKETS];
+  run->next_in_bucket = *bucket;
+  *bucket = run;
+  text_run_push_front(run);
+  text_runs.count++;
+  return run;
+}
+
+// drops the runs using a font (e.g. when it is freed or resized), or all of them for NULL
+static void text_run_cache_drop(RenFont *font) {
+  TextRun *next;
+  for (TextRun *run = text_runs.first; run; run = next) {
+    next = run->next;
+    bool uses_font = !font;
+    for (int i = 0; i < FONT_FALLBACK_MAX && run->fonts[i] && !uses_font; i++)
+      uses_font = run->fonts[i] == font;
+    if (uses_font) text_run_remove(run);
+  }
+}
+
+// iterates over the glyphs of a text, from its cached run if there's one
+typedef struct {
+  RenFont **fonts;
+  const TextRun *run;
+  GlyphGroup *group;
+  // whether the group table can be filled, i.e. we're on the main thread
+  bool fill;
+  int glyph;
+  const char *text, *end;
+} GlyphIterator;
+
+static GlyphIterator glyph_iterator(RenFont **fonts, const char *text, size_t len, RenTab tab, int tab_size, bool fill) {
+  GlyphIterator it = { fonts, NULL, glyph_group_find(fonts, fill), fill, 0, text, text + len };
+  if (len <= TEXT_RUN_MAX_LEN) {
+    TextRunKey key = text_run_key(fonts, text, len, tab, tab_size);
+    it.run = text_run_find(&key);
+  }
+  return it;
+}
+
+static inline bool glyph_iterator_done(const GlyphIterator *it) {
+  return it->run ? it->glyph >= it->run->nglyph : it->text >= it->end;
+}
+
+static RenFont *glyph_iterator_next(GlyphIterator *it, int subpixel_idx, unsigned int *codepoint, SDL_Surface **surface, GlyphMetric **metric) {
+  const RunGlyph *run_glyph = NULL;
+  if (it->run) {
+    run_glyph = &it->run->glyphs[it->glyph++];
+    *codepoint = run_glyph->codepoint;
+  } else {
+    it->text = utf8_to_codepoint(it->text, it->end, codepoint);
+  }
+  const GroupGlyph *glyph = glyph_group_get(it->group, it->fonts, *codepoint, it->fill);
+  if (glyph) return group_glyph_load(glyph, subpixel_idx, surface, metric);
+  if (run_glyph) return font_get_glyph(run_glyph->font, run_glyph->glyph_id, subpixel_idx, surface, metric);
+  return font_group_get_glyph(it->fonts, *codepoint, subpixel_idx, surface, metric);
+}
+
+/******************* Font files **********************/
+// Font files are mapped in memory and handed to FreeType as memory faces, so
+// that loading a glyph doesn't take a seek and a read call for every table it
+// touches. Fonts loaded from the same path (e.g. copies of a font at another
+// size) share the mapping. Files that can't be mapped are read through a SDL
+// stream instead. The list and the reference counts are only used on the main
+// thread.
+static FontFile *font_files = NULL;
+
+static FontFile *font_file_acquire(const char *path) {
+  for (FontFile *file = font_files; file; file = file->next) {
+    if (strcmp(file->path, path) == 0) {
+      file->refs++;
+      return file;
+    }
+  }
+  MappedFile map;
+  if (!map_file(path, &map)) return NULL;
+  FontFile *file = check_alloc(SDL_malloc(sizeof(FontFile) + strlen(path) + 1));
+  strcpy(file->path, path);
+  file->map = map;
+  file->refs = 1;
+  file->next = font_files;
+  font_files = file;
+  return file;
+}
+
+static void font_file_release(FontFile *file) {
+  if (!file || --file->refs > 0) return;
+  FontFile **slot = &font_files;
+  while (*slot != file) slot = &(*slot)->next;
+  *slot = file->next;
+  unmap_file(&file->map);
+  SDL_free(file);
+}
+
 // based on https://github.com/libsdl-org/SDL_ttf/blob/2a094959055fba09f7deed6e1ffeb986188982ae/SDL_ttf.c#L1735
 static unsigned long font_file_read(FT_Stream stream, unsigned long offset, unsigned char *buffer, unsigned long count) {
   uint64_t amount;
@@ -431,6 +1288,19 @@ static void font_file_close(FT_Stream stream) {
   SDL_free(stream);
 }
 
+// opens a face from a mapped file, or through a SDL stream which is closed along with the face
+static FT_Error font_open_face(FT_Library lib, FontFile *mapped, SDL_IOStream *file, FT_Face *face) {
+  if (mapped)
+    return FT_New_Memory_Face(lib, mapped->map.data, (FT_Long) mapped->map.size, 0, face);
+  FT_Stream stream = check_alloc(SDL_calloc(1, sizeof(FT_StreamRec)));
+  stream->read = &font_file_read;
+  stream->close = &font_file_close;
+  stream->descriptor.pointer = file;
+  stream->pos = 0;
+  stream->size = (unsigned long) SDL_GetIOSize(file);
+  return FT_Open_Face(lib, &(FT_Open_Args) { .flags = FT_OPEN_STREAM, .stream = stream }, 0, face);
+}
+
 static int font_set_face_metrics(RenFont *font, FT_Face face) {
   FT_Error err;
   float pixel_size = font->size;
@@ -455,17 +1325,306 @@ static int font_set_face_metrics(RenFont *font, FT_Face face) {
   if ((err = FT_Load_Char(face, ' ', (font_set_load_options(font) | FT_LOAD_BITMAP_METRICS_ONLY | FT_LOAD_NO_HINTING) & ~FT_LOAD_FORCE_AUTOHINT)) != 0)
     return err;
   font->space_advance = face->glyph->advance.x / 64.0f;
+
+  // the box of a text spans its advances and the line height, but marks are
+  // placed over the previous glyph and accents can rise above the ascender
+  float overhang = 0;
+  if (FT_IS_SCALABLE(face)) {
+    float scale = font->size / (float) face->units_per_EM;
+    overhang = fmaxf(-face->bbox.xMin * scale,
+      fmaxf(face->bbox.yMax * scale - font->baseline, -face->bbox.yMin * scale - (font->height - font->baseline)));
+  }
+  if (font->style & FONT_STYLE_ITALIC)
+    overhang += font->baseline / 4.0f;
+  if (font->style & (FONT_STYLE_BOLD | FONT_STYLE_SMOOTH))
+    overhang += 1;
+  font->overhang = (unsigned short) ceilf(fminf(fmaxf(overhang, 0), font->height));
   return 0;
 }
 
-RenFont* ren_font_load(const char* path, float size, ERenFontAntialiasing antialiasing, ERenFontHinting hinting, unsigned char style) {
+/******************* Prewarming **********************/
+// Glyphs can be rasterized ahead of time by a background thread, so that
+// opening a file full of new glyphs or changing the font size doesn't stall
+// a frame. The thread has its own FreeType library, and renders into a private
+// copy of the font opened with it. The bitmaps are copied into the atlases on
+// the main thread, before drawing, and glyphs that have to be drawn before the
+// thread is done with them are rasterized right away, as if they were never
+// queued. The thread also saves the disk cache of the fonts that are freed, so
+// that resizing fonts doesn't wait for the file to be written.
+typedef struct PrewarmJob {
+  struct PrewarmJob *next;
+  RenFont *font;   // NULL once the font is freed or resized
+  RenFont *copy;   // rasterized by the thread, or holding the glyphs to save
+  unsigned int *glyph_ids;
+  int nglyph, capacity;
+  bool save;
+} PrewarmJob;
+
+static struct {
+  SDL_Thread *thread;
+  SDL_Mutex *mutex;
+  SDL_Condition *wake;
+  // jobs waiting for the thread (oldest first), being rasterized, and done
+  PrewarmJob *queue, *running, *done;
+  bool quit;
+} prewarm;
+
+static void prewarm_free_job(PrewarmJob *job) {
+  font_free_disk_cache(job->copy);
+  font_clear_glyph_cache(job->copy);
+  font_file_release(job->copy->file);
+  SDL_free(job->copy);
+  SDL_free(job->glyph_ids);
+  SDL_free(job);
+}
+
+static void prewarm_rasterize(FT_Library lib, PrewarmJob *job) {
+  FT_Face face = NULL;
+  // the mapping of the font file is read only, and can be shared with the thread
+  SDL_IOStream *file = job->copy->file ? NULL : SDL_IOFromFile(job->copy->path, "rb");
+  if ((!job->copy->file && !file) || font_open_face(lib, job->copy->file, file, &face) != 0 || font_set_face_metrics(job->copy, face) != 0) {
+    // the glyphs will be rasterized on the main thread instead
+    if (face) FT_Done_Face(face);
+    return;
+  }
+  for (int i = 0; i < job->nglyph; i++) {
+    for (int bitmap_idx = 0; bitmap_idx < FONT_BITMAP_COUNT(job->copy); bitmap_idx++)
+      font_load_glyph_bitmap(job->copy, job->glyph_ids[i], bitmap_idx);
+  }
+  FT_Done_Face(face);
+  job->copy->face = NULL;
+}
+
+static int prewarm_thread(void *data) {
+  FT_Library lib = NULL;
+  FT_Init_FreeType(&lib);
+  SDL_LockMutex(prewarm.mutex);
+  while (!prewarm.quit) {
+    PrewarmJob *job = prewarm.queue;
+    if (!job) {
+      SDL_WaitCondition(prewarm.wake, prewarm.mutex);
+      continue;
+    }
+    prewarm.queue = job->next;
+    prewarm.running = job;
+    SDL_UnlockMutex(prewarm.mutex);
+    if (job->save) {
+      font_write_disk_cache(job->copy);
+      glyph_cache_prune(job->copy->disk.path);
+    } else if (lib) {
+      prewarm_rasterize(lib, job);
+    }
+    SDL_LockMutex(prewarm.mutex);
+    prewarm.running = NULL;
+    job->next = prewarm.done;
+    prewarm.done = job;
+  }
+  SDL_UnlockMutex(prewarm.mutex);
+  if (lib) FT_Done_FreeType(lib);
+  return 0;
+}
+
+static bool prewarm_start(void) {
+  if (prewarm.thread) return true;
+  prewarm.mutex = SDL_CreateMutex();
+  prewarm.wake = SDL_CreateCondition();
+  if (prewarm.mutex && prewarm.wake)
+    prewarm.thread = SDL_CreateThread(prewarm_thread, "prewarm", NULL);
+  if (!prewarm.thread) {
+    fprintf(stderr, "Warning: (" __FILE__ "): unable to start the prewarming thread: %s\n", SDL_GetError());
+    SDL_DestroyCondition(prewarm.wake);
+    SDL_DestroyMutex(prewarm.mutex);
+    prewarm.wake = NULL;
+    prewarm.mutex = NULL;
+    return false;
+  }
+  return true;
+}
+
+static void prewarm_stop(void) {
+  if (!prewarm.thread) return;
+  SDL_LockMutex(prewarm.mutex);
+  prewarm.quit = true;
+  SDL_SignalCondition(prewarm.wake);
+  SDL_UnlockMutex(prewarm.mutex);
+  SDL_WaitThread(prewarm.thread, NULL);
+  for (PrewarmJob *job = prewarm.queue, *next; job; job = next) {
+    next = job->next;
+    // the glyphs of the fonts freed last are still saved
+    if (job->save) {
+      font_write_disk_cache(job->copy);
+      glyph_cache_prune(job->copy->disk.path);
+    }
+    prewarm_free_job(job);
+  }
+  for (PrewarmJob *job = prewarm.done, *next; job; job = next) { next = job->next; prewarm_free_job(job); }
+  SDL_DestroyCondition(prewarm.wake);
+  SDL_DestroyMutex(prewarm.mutex);
+  memset(&prewarm, 0, sizeof(prewarm));
+}
+
+// forgets the jobs of a font that is being freed or resized
+static void prewarm_cancel(RenFont *font) {
+  if (!prewarm.thread) return;
+  SDL_LockMutex(prewarm.mutex);
+  for (PrewarmJob **job = &prewarm.queue; *job;) {
+    if ((*job)->font == font) {
+      PrewarmJob *cancelled = *job;
+      *job = cancelled->next;
+      prewarm_free_job(cancelled);
+    } else {
+      job = &(*job)->next;
+    }
+  }
+  if (prewarm.running && prewarm.running->font == font) prewarm.running->font = NULL;
+  for (PrewarmJob *job = prewarm.done; job; job = job->next) {
+    if (job->font == font) job->font = NULL;
+  }
+  SDL_UnlockMutex(prewarm.mutex);
+}
+
+static PrewarmJob *prewarm_new_job(RenFont *font) {
+  PrewarmJob *job = check_alloc(SDL_calloc(1, sizeof(PrewarmJob)));
+  size_t len = strlen(font->path);
+  job->font = font;
+  job->copy = check_alloc(SDL_calloc(1, sizeof(RenFont) + len + 1));
+  memcpy(job->copy->path, font->path, len + 1);
+  job->copy->size = font->size;
+  job->copy->antialiasing = font->antialiasing;
+  job->copy->hinting = font->hinting;
+  job->copy->style = font->style;
+  job->copy->file = font->file;
+  if (font->file) font->file->refs++;
+#ifdef LITE_USE_SDL_RENDERER
+  job->copy->scale = font->scale;
+#endif
+  return job;
+}
+
+static void prewarm_queue_job(PrewarmJob *job) {
+  SDL_LockMutex(prewarm.mutex);
+  PrewarmJob **tail = &prewarm.queue;
+  while (*tail) tail = &(*tail)->next;
+  *tail = job;
+  SDL_SignalCondition(prewarm.wake);
+  SDL_UnlockMutex(prewarm.mutex);
+}
+
+// hands the glyphs of a font being freed over to the thread, which saves them
+static bool prewarm_save_disk_cache(RenFont *font) {
+  if (!prewarm_start()) return false;
+  PrewarmJob *job = prewarm_new_job(font);
+  job->font = NULL;
+  job->save = true;
+  job->copy->glyphs = font->glyphs;
+  job->copy->disk = font->disk;
+  memset(&font->glyphs, 0, sizeof(font->glyphs));
+  memset(&font->disk, 0, sizeof(font->disk));
+  prewarm_queue_job(job);
+  return true;
+}
+
+int ren_font_group_prewarm(RenFont **handles, const char *text, size_t len) {
+  if (!prewarm_start()) return 0;
+  RenFont *fonts[FONT_FALLBACK_MAX];
+  font_group_shared(handles, fonts);
+  PrewarmJob *jobs[FONT_FALLBACK_MAX] = { NULL };
+  const char *end = text + len;
+  int queued = 0;
+  while (text < end) {
+    unsigned int codepoint, glyph_id = 0;
+    text = utf8_to_codepoint(text, end, &codepoint);
+    if (is_whitespace(codepoint)) continue;
+    // only the charmap is used to pick the font, loading the glyph metrics is left to the thread
+    int i = 0;
+    while ((glyph_id = font_get_glyph_id(fonts[i], codepoint)) == 0 && i + 1 < FONT_FALLBACK_MAX && fonts[i + 1]) i++;
+    if (!glyph_id) continue;
+    RenFont *font = fonts[i];
+    int row = glyph_id / GLYPHMAP_COL, col = glyph_id - (row * GLYPHMAP_COL);
+    bool needed = false;
+    for (int bitmap_idx = 0; bitmap_idx < FONT_BITMAP_COUNT(font); bitmap_idx++) {
+      if (!font->glyphs.metrics[bitmap_idx][row]) {
+        font->glyphs.metrics[bitmap_idx][row] = check_alloc(SDL_calloc(sizeof(GlyphMetric), GLYPHMAP_COL));
+        font->glyphs.bytesize += sizeof(GlyphMetric) * GLYPHMAP_COL;
+      }
+      GlyphMetric *metric = &font->glyphs.metrics[bitmap_idx][row][col];
+      const GlyphCacheRecord *saved = font_disk_glyph(font, glyph_id, bitmap_idx);
+      // bitmaps saved on disk are cheaper to copy than to rasterize in the background
+      if (saved && (saved->flags & (EGlyphBitmap | EGlyphNoBitmap))) continue;
+      if (!(metric->flags & (EGlyphBitmap | EGlyphNoBitmap | EGlyphPending))) {
+        metric->flags |= EGlyphPending;
+        needed = true;
+      }
+    }
+    if (!needed) continue;
+    if (!jobs[i]) jobs[i] = prewarm_new_job(font);
+    PrewarmJob *job = jobs[i];
+    if (job->nglyph == job->capacity) {
+      job->capacity = job->capacity ? job->capacity * 2 : 64;
+      job->glyph_ids = check_alloc(SDL_realloc(job->glyph_ids, sizeof(unsigned int) * job->capacity));
+    }
+    job->glyph_ids[job->nglyph++] = glyph_id;
+    queued++;
+  }
+  for (int i = 0; i < FONT_FALLBACK_MAX; i++) {
+    if (jobs[i]) prewarm_queue_job(jobs[i]);
+  }
+  return queued;
+}
+
+static void prewarm_copy_glyph(RenFont *font, RenFont *copy, unsigned int glyph_id, int bitmap_idx) {
+  int row = glyph_id / GLYPHMAP_COL, col = glyph_id - (row * GLYPHMAP_COL);
+  GlyphMetric *dst = &font->glyphs.metrics[bitmap_idx][row][col];
+  GlyphMetric *src = copy->glyphs.metrics[bitmap_idx][row] ? &copy->glyphs.metrics[bitmap_idx][row][col] : NULL;
+  if (!(dst->flags & EGlyphPending)) return;
+  dst->flags &= ~EGlyphPending;
+  // without a bitmap from the thread, the glyph is rasterized on the main thread when drawn
+  if (!src || !(src->flags & (EGlyphBitmap | EGlyphNoBitmap))) return;
+  if (!(dst->flags & EGlyphXAdvance)) {
+    dst->xadvance = src->xadvance;
+    dst->flags |= EGlyphXAdvance;
+  }
+  if (src->flags & EGlyphNoBitmap) {
+    dst->flags |= EGlyphNoBitmap;
+    return;
+  }
+  dst->x1 = src->x1;
+  dst->y1 = src->y1 - src->y0;
+  dst->bitmap_left = src->bitmap_left;
+  dst->bitmap_top = src->bitmap_top;
+  dst->format = src->format;
+  SDL_Surface *from = copy->glyphs.atlas[src->format][src->atlas_idx].surfaces[src->surface_idx];
+  font_store_glyph_bitmap(font, dst, (const uint8_t *) from->pixels + (size_t) from->pitch * src->y0, from->pitch);
+  font->disk.dirty = true;
+}
+
+void ren_commit_prewarmed_glyphs(void) {
+  if (!prewarm.thread) return;
+  SDL_LockMutex(prewarm.mutex);
+  PrewarmJob *done = prewarm.done;
+  prewarm.done = NULL;
+  SDL_UnlockMutex(prewarm.mutex);
+  for (PrewarmJob *job = done, *next; job; job = next) {
+    next = job->next;
+    if (job->font) {
+      for (int i = 0; i < job->nglyph; i++) {
+        for (int bitmap_idx = 0; bitmap_idx < FONT_BITMAP_COUNT(job->font); bitmap_idx++)
+          prewarm_copy_glyph(job->font, job->copy, job->glyph_ids[i], bitmap_idx);
+      }
+    }
+    prewarm_free_job(job);
+  }
+}
+
+static RenFont *font_shared_load(const char *path, float size, int scale, ERenFontAntialiasing antialiasing, ERenFontHinting hinting, unsigned char style) {
   FT_Error err = FT_Err_Ok;
   SDL_IOStream *file = NULL; RenFont *font = NULL;
-  FT_Face face = NULL; FT_Stream stream = NULL;
+  FT_Face face = NULL;
+
+  FontFile *mapped = font_file_acquire(path);
+  if (!mapped && !(file = SDL_IOFromFile(path, "rb")))
+    return NULL; // error set by SDL_IOFromFile
 
-  file = SDL_IOFromFile(path, "rb");
-  if (!file) return NULL; // error set by SDL_IOFromFile
-  
   int len = strlen(path);
   font = check_alloc(SDL_calloc(1, sizeof(RenFont) + len + 1));
   strcpy(font->path, path);
@@ -474,33 +1633,114 @@ RenFont* ren_font_load(const char* path, float size, ERenFontAntialiasing antial
   font->hinting = hinting;
   font->style = style;
   font->tab_size = 2;
+  font->glyphs.budget = GLYPH_CACHE_BUDGET;
 #ifdef LITE_USE_SDL_RENDERER
-  font->scale = 1;
+  font->scale = scale;
 #endif
 
-  stream = check_alloc(SDL_calloc(1, sizeof(FT_StreamRec)));
-  if (!stream) goto stream_failure;
-  stream->read = &font_file_read;
-  stream->close = &font_file_close;
-  stream->descriptor.pointer = file;
-  stream->pos = 0;
-  stream->size = (unsigned long) SDL_GetIOSize(file);
-
-  if ((err = FT_Open_Face(library, &(FT_Open_Args) { .flags = FT_OPEN_STREAM, .stream = stream }, 0, &face)) != 0)
+  font->shared = font;
+  font->file = mapped;
+  if ((err = font_open_face(library, mapped, file, &face)) != 0)
     goto failure;
   if ((err = font_set_face_metrics(font, face)) != 0)
     goto failure;
+  font_open_disk_cache(font);
   return font;
 
-stream_failure:
-  if (file) SDL_CloseIO(file);
 failure:
   if (err != FT_Err_Ok) SDL_SetError("%s", get_ft_error(err));
   if (face) FT_Done_Face(face);
+  font_file_release(mapped);
   if (font) SDL_free(font);
   return NULL;
 }
 
+static void font_shared_free(RenFont *font) {
+  prewarm_cancel(font);
+  text_run_cache_drop(font);
+  glyph_group_drop(font);
+  if (font->disk.dirty && font->disk.path && glyph_cache_dir && SDL_CreateDirectory(glyph_cache_dir)
+      && !prewarm_save_disk_cache(font)) {
+    font_write_disk_cache(font);
+    glyph_cache_prune(font->disk.path);
+  }
+  font_free_disk_cache(font);
+  font_clear_glyph_cache(font);
+  // free codepoint cache as well
+  for (int i = 0; i < CHARMAP_ROW; i++) {
+    SDL_free(font->charmap.rows[i]);
+  }
+  FT_Done_Face(font->face);
+  font_file_release(font->file);
+  SDL_free(font);
+}
+
+/******************* Font registry **********************/
+// The fonts given out are handles on a shared font, which holds the face and
+// the glyphs and is looked up by path, size and the options that change how
+// glyphs are rasterized. Fonts loaded again at the same size (e.g. by
+// plugins), and copies that only differ by their decorations or tab size,
+// share their glyphs instead of rasterizing them again. Everything below
+// the public functions works on shared fonts.
+#define FONT_STYLE_OUTLINE (FONT_STYLE_BOLD | FONT_STYLE_ITALIC | FONT_STYLE_SMOOTH)
+
+static RenFont *shared_fonts = NULL;
+
+static RenFont *font_shared_acquire(const char *path, float size, int scale, ERenFontAntialiasing antialiasing, ERenFontHinting hinting, unsigned char style) {
+  style &= FONT_STYLE_OUTLINE;
+  for (RenFont *font = shared_fonts; font; font = font->next) {
+#ifdef LITE_USE_SDL_RENDERER
+    if (font->scale != scale) continue;
+#endif
+    if (font->size == size && font->antialiasing == antialiasing && font->hinting == hinting
+        && font->style == style && strcmp(font->path, path) == 0) {
+      font->refs++;
+      return font;
+    }
+  }
+  RenFont *font = font_shared_load(path, size, scale, antialiasing, hinting, style);
+  if (!font) return NULL;
+  font->refs = 1;
+  font->next = shared_fonts;
+  shared_fonts = font;
+  return font;
+}
+
+static void font_shared_release(RenFont *font) {
+  if (--font->refs > 0) return;
+  RenFont **slot = &shared_fonts;
+  while (*slot != font) slot = &(*slot)->next;
+  *slot = font->next;
+  font_shared_free(font);
+}
+
+// handles keep a copy of the metrics of their shared font
+static void font_set_shared(RenFont *handle, RenFont *shared) {
+  handle->shared = shared;
+  handle->size = shared->size;
+#ifdef LITE_USE_SDL_RENDERER
+  handle->scale = shared->scale;
+#endif
+  handle->space_advance = shared->space_advance;
+  handle->baseline = shared->baseline;
+  handle->height = shared->height;
+  handle->underline_thickness = shared->underline_thickness;
+  handle->overhang = shared->overhang;
+}
+
+RenFont* ren_font_load(const char* path, float size, ERenFontAntialiasing antialiasing, ERenFontHinting hinting, unsigned char style) {
+  RenFont *shared = font_shared_acquire(path, size, 1, antialiasing, hinting, style);
+  if (!shared) return NULL; // error set by font_shared_load()
+  RenFont *font = check_alloc(SDL_calloc(1, sizeof(RenFont) + strlen(path) + 1));
+  strcpy(font->path, path);
+  font->antialiasing = antialiasing;
+  font->hinting = hinting;
+  font->style = style;
+  font->tab_size = 2;
+  font_set_shared(font, shared);
+  return font;
+}
+
 RenFont* ren_font_copy(RenFont* font, float size, ERenFontAntialiasing antialiasing, ERenFontHinting hinting, int style) {
   antialiasing = antialiasing == -1 ? font->antialiasing : antialiasing;
   hinting = hinting == -1 ? font->hinting : hinting;
@@ -514,12 +1754,7 @@ const char* ren_font_get_path(RenFont *font) {
 }
 
 void ren_font_free(RenFont* font) {
-  font_clear_glyph_cache(font);
-  // free codepoint cache as well
-  for (int i = 0; i < CHARMAP_ROW; i++) {
-    SDL_free(font->charmap.rows[i]);
-  }
-  FT_Done_Face(font->face);
+  font_shared_release(font->shared);
   SDL_free(font);
 }
 
@@ -539,29 +1774,73 @@ float ren_font_group_get_size(RenFont **fonts) {
 
 void ren_font_group_set_size(RenFont **fonts, float size, int surface_scale) {
   for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i) {
-    font_clear_glyph_cache(fonts[i]);
-    fonts[i]->size = size;
-    fonts[i]->tab_size = 2;
-    #ifdef LITE_USE_SDL_RENDERER
-    fonts[i]->scale = surface_scale;
-    #endif
-    font_set_face_metrics(fonts[i], fonts[i]->face);
+    RenFont *font = fonts[i];
+    // the new shared font is acquired first, so that the file stays mapped
+    RenFont *shared = font_shared_acquire(font->path, size, surface_scale, font->antialiasing, font->hinting, font->style);
+    if (!shared) {
+      fprintf(stderr, "Warning: (" __FILE__ "): unable to resize font %s: %s\n", font->path, SDL_GetError());
+      continue;
+    }
+    font_shared_release(font->shared);
+    font_set_shared(font, shared);
+    font->tab_size = 2;
+  }
+}
+
+void ren_font_group_set_cache_budget(RenFont **fonts, size_t budget) {
+  for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i)
+    fonts[i]->shared->glyphs.budget = budget;
+}
+
+void ren_font_group_get_cache_stats(RenFont **fonts, RenGlyphCacheStats *stats) {
+  memset(stats, 0, sizeof(*stats));
+  for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i) {
+    GlyphMap *glyphs = &fonts[i]->shared->glyphs;
+    stats->bytes += glyphs->bytesize;
+    stats->budget += glyphs->budget;
+    stats->evictions += glyphs->evictions;
+    for (int glyph_format_idx = 0; glyph_format_idx < EGlyphFormatSize; glyph_format_idx++) {
+      for (size_t atlas_idx = 0; atlas_idx < glyphs->natlas[glyph_format_idx]; atlas_idx++) {
+        GlyphAtlas *atlas = &glyphs->atlas[glyph_format_idx][atlas_idx];
+        stats->surfaces += atlas->nsurface;
+        for (unsigned int surface_idx = 0; surface_idx < atlas->nsurface; surface_idx++) {
+          SDL_Surface *surface = atlas->surfaces[surface_idx];
+          GlyphMetric *last = SDL_GetPointerProperty(SDL_GetSurfaceProperties(surface), "metric", NULL);
+          stats->atlas_bytes += (size_t) surface->pitch * surface->h;
+          if (last) stats->used_bytes += (size_t) surface->pitch * last->y1;
+        }
+      }
+    }
   }
 }
 
+void ren_glyph_cache_tick(void) {
+  glyph_frame++;
+}
+
 int ren_font_group_get_height(RenFont **fonts) {
   return fonts[0]->height;
 }
 
+int ren_font_group_get_overhang(RenFont **fonts) {
+  int overhang = 0;
+  for (int i = 0; i < FONT_FALLBACK_MAX && fonts[i]; ++i) {
+    // fallback glyphs can be taller than the line
+    int font_overhang = fonts[i]->overhang + (fonts[i]->height > fonts[0]->height ? fonts[i]->height - fonts[0]->height : 0);
+    if (font_overhang > overhang) overhang = font_overhang;
+  }
+  return overhang;
+}
+
 // some fonts provide xadvance for whitespaces (e.g. Unifont), which we need to ignore
-float font_get_xadvance(RenFont *font, unsigned int codepoint, GlyphMetric *metric, double curr_x, RenTab tab) {
+float font_get_xadvance(RenFont *font, unsigned int codepoint, GlyphMetric *metric, double curr_x, RenTab tab, int tab_size_spaces) {
   if (!is_whitespace(codepoint) && metric && metric->xadvance) {
     return metric->xadvance;
   }
   if (codepoint != '\t') {
     return font->space_advance;
   }
-  float tab_size = font->space_advance * font->tab_size;
+  float tab_size = font->space_advance * tab_size_spaces;
   if (isnan(tab.offset)) {
     return tab_size;
   }
@@ -574,24 +1853,61 @@ float font_get_xadvance(RenFont *font, unsigned int codepoint, GlyphMetric *metr
   return adv;
 }
 
-double ren_font_group_get_width(RenFont **fonts, const char *text, size_t len, RenTab tab, int *x_offset) {
+// resolves the glyphs of a text (if `glyphs` isn't NULL) and returns its width
+static double text_measure(RenFont **fonts, const char *text, size_t len, RenTab tab, int tab_size, RunGlyph *glyphs, int *nglyph, GlyphMetric **first) {
   double width = 0;
   const char* end = text + len;
-
-  bool set_x_offset = x_offset == NULL;
+  GlyphGroup *group = glyph_group_find(fonts, true);
+  int n = 0;
   while (text < end) {
-    unsigned int codepoint;
+    unsigned int codepoint, glyph_id = 0;
     text = utf8_to_codepoint(text, end, &codepoint);
-    GlyphMetric *metric = NULL;
-    font_group_get_glyph(fonts, codepoint, 0, NULL, &metric);
-    width += font_get_xadvance(fonts[0], codepoint, metric, width, tab);
-    if (!set_x_offset && metric) {
-      set_x_offset = true;
-      *x_offset = metric->bitmap_left; // TODO: should this be scaled by the surface scale?
+    const GroupGlyph *glyph = glyph_group_get(group, fonts, codepoint, true);
+    RenFont *font;
+    GlyphMetric *metric;
+    if (glyph) {
+      font = glyph->font;
+      glyph_id = glyph->glyph_id;
+      metric = glyph->metrics[0];
+    } else {
+      font = font_group_find_glyph(fonts, codepoint, &glyph_id);
+      metric = font_load_glyph_metric(font, glyph_id, 0);
+    }
+    width += font_get_xadvance(fonts[0], codepoint, metric, width, tab, tab_size);
+    if (!*first && metric) *first = metric;
+    if (glyphs) glyphs[n++] = (RunGlyph) { font, glyph_id, codepoint };
+  }
+  if (nglyph) *nglyph = n;
+  return width;
+}
+
+double ren_font_group_get_width(RenFont **handles, const char *text, size_t len, RenTab tab, int *x_offset) {
+  RenFont *fonts[FONT_FALLBACK_MAX];
+  font_group_shared(handles, fonts);
+  int tab_size = handles[0]->tab_size;
+  double width;
+  GlyphMetric *first = NULL;
+  if (len > TEXT_RUN_MAX_LEN) {
+    width = text_measure(fonts, text, len, tab, tab_size, NULL, NULL, &first);
+  } else {
+    TextRunKey key = text_run_key(fonts, text, len, tab, tab_size);
+    TextRun *run = text_run_find(&key);
+    if (run) {
+      text_run_unlink(run);
+      text_run_push_front(run);
+      // the bitmap offset is only known once the glyph has been drawn, so it isn't cached
+      for (int i = 0; i < run->nglyph && !first; i++)
+        first = font_load_glyph_metric(run->glyphs[i].font, run->glyphs[i].glyph_id, 0);
+      width = run->width;
+    } else {
+      RunGlyph glyphs[TEXT_RUN_MAX_LEN];
+      int nglyph;
+      width = text_measure(fonts, text, len, tab, tab_size, glyphs, &nglyph, &first);
+      text_run_add(&key, glyphs, nglyph, width);
     }
   }
-  if (!set_x_offset)
-    *x_offset = 0;
+  if (x_offset)
+    *x_offset = first ? first->bitmap_left : 0; // TODO: should this be scaled by the surface scale?
 #ifdef LITE_USE_SDL_RENDERER
   return width / fonts[0]->scale;
 #else
@@ -603,6 +1919,7 @@ double ren_font_group_get_width(RenFont **fonts, const char *text, size_t len, R
 // this function can be used to debug font atlases, it is not public
 void ren_font_dump(RenFont *font) {
   char filename[1024];
+  font = font->shared;
   for (int glyph_format_idx = 0; glyph_format_idx < EGlyphFormatSize; glyph_format_idx++) {
     for (int atlas_idx = 0; atlas_idx < font->glyphs.natlas[glyph_format_idx]; atlas_idx++) {
       GlyphAtlas *atlas = &font->glyphs.atlas[glyph_format_idx][atlas_idx];
@@ -616,38 +1933,335 @@ void ren_font_dump(RenFont *font) {
 }
 #endif
 
-double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t len, float x, int y, RenColor color, RenTab tab) {
+/******************* Blending **********************/
+// Glyph coverage is blended one row at a time, for each color channel:
+//   dst = (color * cov * color.a + dst * (65025 - cov * color.a) + 32767) / 65025
+// The vectorized kernels compute this in floats, where every intermediate
+// value is an integer below 2^24 and thus exact, and correct the quotient by
+// one where the multiplication by the reciprocal rounded it off, so they
+// produce the same pixels as the scalar one.
+// Translucent rects are blended the same way with
+//   dst = (color * color.a + dst * (255 - color.a) + 127) / 255
+// which fits in 16bit lanes, where x / 255 == (x + 1 + (x >> 8)) >> 8.
+// They all work on 32bit pixels with red, green and blue in bits 16, 8 and 0,
+// the bits in `keep` are left as they are.
+typedef void (*GlyphRowBlender)(uint32_t *dst, const uint8_t *src, int n, RenColor color, uint32_t keep, bool subpixel);
+typedef void (*RectRowBlender)(uint32_t *dst, int n, RenColor color, uint32_t keep);
+
+static inline unsigned blend_glyph_channel(unsigned c, unsigned d, unsigned sa) {
+  return (c * sa + d * (65025 - sa) + 32767) / 65025;
+}
+
+static void blend_glyph_row_scalar(uint32_t *dst, const uint8_t *src, int n, RenColor color, uint32_t keep, bool subpixel) {
+  for (int i = 0; i < n; i++) {
+    // subpixel coverage is stored as r, g, b
+    unsigned cr = subpixel ? src[i * 3] : src[i];
+    unsigned cg = subpixel ? src[i * 3 + 1] : src[i];
+    unsigned cb = subpixel ? src[i * 3 + 2] : src[i];
+    uint32_t d = dst[i];
+    dst[i] = (d & keep)
+      | blend_glyph_channel(color.r, (d >> 16) & 0xff, cr * color.a) << 16
+      | blend_glyph_channel(color.g, (d >> 8) & 0xff, cg * color.a) << 8
+      | blend_glyph_channel(color.b, d & 0xff, cb * color.a);
+  }
+}
+
+static void blend_rect_row_scalar(uint32_t *dst, int n, RenColor color, uint32_t keep) {
+  const unsigned ia = 0xff - color.a;
+  const unsigned r = color.r * color.a + 127, g = color.g * color.a + 127, b = color.b * color.a + 127;
+  for (int i = 0; i < n; i++) {
+    uint32_t d = dst[i];
+    dst[i] = (d & keep)
+      | (r + ((d >> 16) & 0xff) * ia) / 255 << 16
+      | (g + ((d >> 8) & 0xff) * ia) / 255 << 8
+      | (b + (d & 0xff) * ia) / 255;
+  }
+}
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RENDERER_SSE2
+#include <immintrin.h>
+
+static inline __m128i blend_glyph_channel_sse2(__m128 c, __m128i d, __m128 sa) {
+  const __m128 full = _mm_set1_ps(65025), one = _mm_set1_ps(1);
+  __m128 x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(c, sa), _mm_mul_ps(_mm_cvtepi32_ps(d), _mm_sub_ps(full, sa))), _mm_set1_ps(32767));
+  __m128 q = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.0f / 65025))));
+  __m128 r = _mm_sub_ps(x, _mm_mul_ps(q, full));
+  q = _mm_add_ps(q, _mm_and_ps(_mm_cmpge_ps(r, full), one));
+  q = _mm_sub_ps(q, _mm_and_ps(_mm_cmplt_ps(r, _mm_setzero_ps()), one));
+  return _mm_cvttps_epi32(q);
+}
+
+static void blend_glyph_row_sse2(uint32_t *dst, const uint8_t *src, int n, RenColor color, uint32_t keep, bool subpixel) {
+  const __m128 a = _mm_set1_ps(color.a);
+  const __m128 r = _mm_set1_ps(color.r), g = _mm_set1_ps(color.g), b = _mm_set1_ps(color.b);
+  const __m128i byte = _mm_set1_epi32(0xff), keep4 = _mm_set1_epi32(keep);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128 cr, cg, cb;
+    if (subpixel) {
+      const uint8_t *s = src + i * 3;
+      cr = _mm_mul_ps(_mm_set_ps(s[9], s[6], s[3], s[0]), a);
+      cg = _mm_mul_ps(_mm_set_ps(s[10], s[7], s[4], s[1]), a);
+      cb = _mm_mul_ps(_mm_set_ps(s[11], s[8], s[5], s[2]), a);
+    } else {
+      uint32_t s;
+      memcpy(&s, src + i, sizeof(s));
+      __m128i cov = _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(s), _mm_setzero_si128()), _mm_setzero_si128());
+      cr = cg = cb = _mm_mul_ps(_mm_cvtepi32_ps(cov), a);
+    }
+    __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+    __m128i out = _mm_and_si128(d, keep4);
+    out = _mm_or_si128(out, _mm_slli_epi32(blend_glyph_channel_sse2(r, _mm_and_si128(_mm_srli_epi32(d, 16), byte), cr), 16));
+    out = _mm_or_si128(out, _mm_slli_epi32(blend_glyph_channel_sse2(g, _mm_and_si128(_mm_srli_epi32(d, 8), byte), cg), 8));
+    out = _mm_or_si128(out, blend_glyph_channel_sse2(b, _mm_and_si128(d, byte), cb));
+    _mm_storeu_si128((__m128i *) (dst + i), out);
+  }
+  blend_glyph_row_scalar(dst + i, src + (subpixel ? i * 3 : i), n - i, color, keep, subpixel);
+}
+
+static inline __m128i blend_rect_channels_sse2(__m128i ca, __m128i d, __m128i ia) {
+  __m128i x = _mm_add_epi16(ca, _mm_mullo_epi16(d, ia));
+  return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(x, _mm_set1_epi16(1)), _mm_srli_epi16(x, 8)), 8);
+}
+
+static void blend_rect_row_sse2(uint32_t *dst, int n, RenColor color, uint32_t keep) {
+  // pixels are stored as b, g, r, and a or unused
+  const short b = color.b * color.a + 127, g = color.g * color.a + 127, r = color.r * color.a + 127;
+  const __m128i ca = _mm_setr_epi16(b, g, r, 0, b, g, r, 0), ia = _mm_set1_epi16(0xff - color.a);
+  const __m128i keep4 = _mm_set1_epi32(keep), rgb4 = _mm_set1_epi32(0xffffff);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128i d = _mm_loadu_si128((const __m128i *) (dst + i));
+    __m128i lo = blend_rect_channels_sse2(ca, _mm_unpacklo_epi8(d, _mm_setzero_si128()), ia);
+    __m128i hi = blend_rect_channels_sse2(ca, _mm_unpackhi_epi8(d, _mm_setzero_si128()), ia);
+    __m128i out = _mm_and_si128(_mm_packus_epi16(lo, hi), rgb4);
+    _mm_storeu_si128((__m128i *) (dst + i), _mm_or_si128(out, _mm_and_si128(d, keep4)));
+  }
+  blend_rect_row_scalar(dst + i, n - i, color, keep);
+}
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RENDERER_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER)
+#define RENDERER_AVX2
+#endif
+#endif
+
+#ifdef RENDERER_AVX2
+static inline RENDERER_AVX2 __m256i blend_glyph_channel_avx2(__m256 c, __m256i d, __m256 sa) {
+  const __m256 full = _mm256_set1_ps(65025), one = _mm256_set1_ps(1);
+  __m256 x = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(c, sa), _mm256_mul_ps(_mm256_cvtepi32_ps(d), _mm256_sub_ps(full, sa))), _mm256_set1_ps(32767));
+  __m256 q = _mm256_cvtepi32_ps(_mm256_cvttps_epi32(_mm256_mul_ps(x, _mm256_set1_ps(1.0f / 65025))));
+  __m256 r = _mm256_sub_ps(x, _mm256_mul_ps(q, full));
+  q = _mm256_add_ps(q, _mm256_and_ps(_mm256_cmp_ps(r, full, _CMP_GE_OQ), one));
+  q = _mm256_sub_ps(q, _mm256_and_ps(_mm256_cmp_ps(r, _mm256_setzero_ps(), _CMP_LT_OQ), one));
+  return _mm256_cvttps_epi32(q);
+}
+
+static RENDERER_AVX2 void blend_glyph_row_avx2(uint32_t *dst, const uint8_t *src, int n, RenColor color, uint32_t keep, bool subpixel) {
+  const __m256 a = _mm256_set1_ps(color.a);
+  const __m256 r = _mm256_set1_ps(color.r), g = _mm256_set1_ps(color.g), b = _mm256_set1_ps(color.b);
+  const __m256i byte = _mm256_set1_epi32(0xff), keep8 = _mm256_set1_epi32(keep);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256 cr, cg, cb;
+    if (subpixel) {
+      const uint8_t *s = src + i * 3;
+      cr = _mm256_mul_ps(_mm256_set_ps(s[21], s[18], s[15], s[12], s[9], s[6], s[3], s[0]), a);
+      cg = _mm256_mul_ps(_mm256_set_ps(s[22], s[19], s[16], s[13], s[10], s[7], s[4], s[1]), a);
+      cb = _mm256_mul_ps(_mm256_set_ps(s[23], s[20], s[17], s[14], s[11], s[8], s[5], s[2]), a);
+    } else {
+      __m128i cov = _mm_loadl_epi64((const __m128i *) (src + i));
+      cr = cg = cb = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(cov)), a);
+    }
+    __m256i d = _mm256_loadu_si256((const __m256i *) (dst + i));
+    __m256i out = _mm256_and_si256(d, keep8);
+    out = _mm256_or_si256(out, _mm256_slli_epi32(blend_glyph_channel_avx2(r, _mm256_and_si256(_mm256_srli_epi32(d, 16), byte), cr), 16));
+    out = _mm256_or_si256(out, _mm256_slli_epi32(blend_glyph_channel_avx2(g, _mm256_and_si256(_mm256_srli_epi32(d, 8), byte), cg), 8));
+    out = _mm256_or_si256(out, blend_glyph_channel_avx2(b, _mm256_and_si256(d, byte), cb));
+    _mm256_storeu_si256((__m256i *) (dst + i), out);
+  }
+  blend_glyph_row_sse2(dst + i, src + (subpixel ? i * 3 : i), n - i, color, keep, subpixel);
+}
+
+static inline RENDERER_AVX2 __m256i blend_rect_channels_avx2(__m256i ca, __m256i d, __m256i ia) {
+  __m256i x = _mm256_add_epi16(ca, _mm256_mullo_epi16(d, ia));
+  return _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(x, _mm256_set1_epi16(1)), _mm256_srli_epi16(x, 8)), 8);
+}
+
+static RENDERER_AVX2 void blend_rect_row_avx2(uint32_t *dst, int n, RenColor color, uint32_t keep) {
+  const short b = color.b * color.a + 127, g = color.g * color.a + 127, r = color.r * color.a + 127;
+  const __m256i ca = _mm256_setr_epi16(b, g, r, 0, b, g, r, 0, b, g, r, 0, b, g, r, 0), ia = _mm256_set1_epi16(0xff - color.a);
+  const __m256i keep8 = _mm256_set1_epi32(keep), rgb8 = _mm256_set1_epi32(0xffffff);
+  int i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m256i d = _mm256_loadu_si256((const __m256i *) (dst + i));
+    // unpacking and packing both work within 128bit lanes, so pixels stay in order
+    __m256i lo = blend_rect_channels_avx2(ca, _mm256_unpacklo_epi8(d, _mm256_setzero_si256()), ia);
+    __m256i hi = blend_rect_channels_avx2(ca, _mm256_unpackhi_epi8(d, _mm256_setzero_si256()), ia);
+    __m256i out = _mm256_and_si256(_mm256_packus_epi16(lo, hi), rgb8);
+    _mm256_storeu_si256((__m256i *) (dst + i), _mm256_or_si256(out, _mm256_and_si256(d, keep8)));
+  }
+  blend_rect_row_sse2(dst + i, n - i, color, keep);
+}
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define RENDERER_NEON
+#include <arm_neon.h>
+
+static inline uint32x4_t blend_glyph_channel_neon(float32x4_t c, uint32x4_t d, float32x4_t sa) {
+  const float32x4_t full = vdupq_n_f32(65025), one = vdupq_n_f32(1);
+  float32x4_t x = vaddq_f32(vaddq_f32(vmulq_f32(c, sa), vmulq_f32(vcvtq_f32_u32(d), vsubq_f32(full, sa))), vdupq_n_f32(32767));
+  float32x4_t q = vcvtq_f32_u32(vcvtq_u32_f32(vmulq_f32(x, vdupq_n_f32(1.0f / 65025))));
+  float32x4_t r = vsubq_f32(x, vmulq_f32(q, full));
+  q = vaddq_f32(q, vreinterpretq_f32_u32(vandq_u32(vcgeq_f32(r, full), vreinterpretq_u32_f32(one))));
+  q = vsubq_f32(q, vreinterpretq_f32_u32(vandq_u32(vcltq_f32(r, vdupq_n_f32(0)), vreinterpretq_u32_f32(one))));
+  return vcvtq_u32_f32(q);
+}
+
+static void blend_glyph_row_neon(uint32_t *dst, const uint8_t *src, int n, RenColor color, uint32_t keep, bool subpixel) {
+  const float32x4_t a = vdupq_n_f32(color.a);
+  const float32x4_t r = vdupq_n_f32(color.r), g = vdupq_n_f32(color.g), b = vdupq_n_f32(color.b);
+  const uint32x4_t byte = vdupq_n_u32(0xff), keep4 = vdupq_n_u32(keep);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    float32x4_t cr, cg, cb;
+    if (subpixel) {
+      const uint8_t *s = src + i * 3;
+      const float lr[4] = { s[0], s[3], s[6], s[9] };
+      const float lg[4] = { s[1], s[4], s[7], s[10] };
+      const float lb[4] = { s[2], s[5], s[8], s[11] };
+      cr = vmulq_f32(vld1q_f32(lr), a);
+      cg = vmulq_f32(vld1q_f32(lg), a);
+      cb = vmulq_f32(vld1q_f32(lb), a);
+    } else {
+      const float l[4] = { src[i], src[i + 1], src[i + 2], src[i + 3] };
+      cr = cg = cb = vmulq_f32(vld1q_f32(l), a);
+    }
+    uint32x4_t d = vld1q_u32(dst + i);
+    uint32x4_t out = vandq_u32(d, keep4);
+    out = vorrq_u32(out, vshlq_n_u32(blend_glyph_channel_neon(r, vandq_u32(vshrq_n_u32(d, 16), byte), cr), 16));
+    out = vorrq_u32(out, vshlq_n_u32(blend_glyph_channel_neon(g, vandq_u32(vshrq_n_u32(d, 8), byte), cg), 8));
+    out = vorrq_u32(out, blend_glyph_channel_neon(b, vandq_u32(d, byte), cb));
+    vst1q_u32(dst + i, out);
+  }
+  blend_glyph_row_scalar(dst + i, src + (subpixel ? i * 3 : i), n - i, color, keep, subpixel);
+}
+
+static inline uint16x8_t blend_rect_channels_neon(uint16x8_t ca, uint8x8_t d, uint8x8_t ia) {
+  uint16x8_t x = vmlal_u8(ca, d, ia);
+  return vshrq_n_u16(vaddq_u16(vaddq_u16(x, vdupq_n_u16(1)), vshrq_n_u16(x, 8)), 8);
+}
+
+static void blend_rect_row_neon(uint32_t *dst, int n, RenColor color, uint32_t keep) {
+  const uint16_t b = color.b * color.a + 127, g = color.g * color.a + 127, r = color.r * color.a + 127;
+  const uint16_t channels[8] = { b, g, r, 0, b, g, r, 0 };
+  const uint16x8_t ca = vld1q_u16(channels);
+  const uint8x8_t ia = vdup_n_u8(0xff - color.a);
+  const uint32x4_t keep4 = vdupq_n_u32(keep), rgb4 = vdupq_n_u32(0xffffff);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    uint8x16_t d = vld1q_u8((const uint8_t *) (dst + i));
+    uint16x8_t lo = blend_rect_channels_neon(ca, vget_low_u8(d), ia);
+    uint16x8_t hi = blend_rect_channels_neon(ca, vget_high_u8(d), ia);
+    uint32x4_t out = vandq_u32(vreinterpretq_u32_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi))), rgb4);
+    vst1q_u32(dst + i, vorrq_u32(out, vandq_u32(vreinterpretq_u32_u8(d), keep4)));
+  }
+  blend_rect_row_scalar(dst + i, n - i, color, keep);
+}
+#endif
+
+static GlyphRowBlender blend_glyph_row = blend_glyph_row_scalar;
+static RectRowBlender blend_rect_row = blend_rect_row_scalar;
+
+static void init_blenders(void) {
+#if defined(RENDERER_AVX2)
+  bool avx2 = SDL_HasAVX2();
+  blend_glyph_row = avx2 ? blend_glyph_row_avx2 : blend_glyph_row_sse2;
+  blend_rect_row = avx2 ? blend_rect_row_avx2 : blend_rect_row_sse2;
+#elif defined(RENDERER_SSE2)
+  blend_glyph_row = blend_glyph_row_sse2;
+  blend_rect_row = blend_rect_row_sse2;
+#elif defined(RENDERER_NEON)
+  blend_glyph_row = blend_glyph_row_neon;
+  blend_rect_row = blend_rect_row_neon;
+#endif
+}
+
+// whether the kernels above can blend onto this format
+static bool is_blendable_format(const SDL_PixelFormatDetails *format) {
+  return format->bytes_per_pixel == 4
+    && format->Rmask == 0xff0000 && format->Gmask == 0xff00 && format->Bmask == 0xff
+    && (format->Amask == 0 || format->Amask == 0xff000000);
+}
+
+static SDL_Rect surface_clip_rect(RenSurface *rs) {
+  SDL_Rect clip = { rs->clip.x * rs->scale, rs->clip.y * rs->scale, rs->clip.width * rs->scale, rs->clip.height * rs->scale };
+  SDL_Rect bounds = { 0, 0, rs->surface->w, rs->surface->h };
+  if (!SDL_GetRectIntersection(&clip, &bounds, &clip))
+    clip.w = clip.h = 0;
+  return clip;
+}
+
+// loads every glyph bitmap that ren_draw_text() would need for this text, so
+// that the glyph cache is only read while drawing (e.g. from several threads)
+void ren_font_group_load_glyphs(RenSurface *rs, RenFont **handles, const char *text, size_t len, float x, RenTab tab, int tab_size) {
+  RenFont *fonts[FONT_FALLBACK_MAX];
+  font_group_shared(handles, fonts);
+  double pen_x = x * rs->scale;
+  double original_pen_x = pen_x;
+  GlyphIterator it = glyph_iterator(fonts, text, len, tab, tab_size, true);
+  while (!glyph_iterator_done(&it)) {
+    unsigned int codepoint;
+    SDL_Surface *font_surface = NULL; GlyphMetric *metric = NULL;
+    glyph_iterator_next(&it, (int)(fmod(pen_x, 1.0) * SUBPIXEL_BITMAPS_CACHED), &codepoint, &font_surface, &metric);
+    if (!metric)
+      break;
+    pen_x += font_get_xadvance(fonts[0], codepoint, metric, pen_x - original_pen_x, tab, tab_size);
+  }
+}
+
+double ren_draw_text(RenSurface *rs, RenFont **handles, const char *text, size_t len, float x, int y, RenColor color, RenTab tab, int tab_size) {
+  RenFont *fonts[FONT_FALLBACK_MAX];
+  font_group_shared(handles, fonts);
   SDL_Surface *surface = rs->surface;
-  SDL_Rect clip;
-  SDL_GetSurfaceClipRect(surface, &clip);
+  SDL_Rect clip = surface_clip_rect(rs);
 
   const int surface_scale = rs->scale;
   double pen_x = x * surface_scale;
   double original_pen_x = pen_x;
   y *= surface_scale;
-  const char* end = text + len;
+  GlyphIterator it = glyph_iterator(fonts, text, len, tab, tab_size, false);
   uint8_t* destination_pixels = surface->pixels;
   int clip_end_x = clip.x + clip.w, clip_end_y = clip.y + clip.h;
 
   RenFont* last = NULL;
   double last_pen_x = x;
-  bool underline = fonts[0]->style & FONT_STYLE_UNDERLINE;
-  bool strikethrough = fonts[0]->style & FONT_STYLE_STRIKETHROUGH;
-
-  while (text < end) {
+  // decorations aren't part of the shared font
+  bool underline = handles[0]->style & FONT_STYLE_UNDERLINE;
+  bool strikethrough = handles[0]->style & FONT_STYLE_STRIKETHROUGH;
+  int drawn = 0;
+  const SDL_PixelFormatDetails* surface_format = SDL_GetPixelFormatDetails(surface->format);
+  const bool blendable = is_blendable_format(surface_format);
+
+  while (!glyph_iterator_done(&it)) {
     unsigned int codepoint, r, g, b;
-    text = utf8_to_codepoint(text, end,  &codepoint);
     SDL_Surface *font_surface = NULL; GlyphMetric *metric = NULL;
-    RenFont* font = font_group_get_glyph(fonts, codepoint, (int)(fmod(pen_x, 1.0) * SUBPIXEL_BITMAPS_CACHED), &font_surface, &metric);
+    RenFont* font = glyph_iterator_next(&it, (int)(fmod(pen_x, 1.0) * SUBPIXEL_BITMAPS_CACHED), &codepoint, &font_surface, &metric);
     if (!metric)
       break;
     int start_x = floor(pen_x) + metric->bitmap_left;
     int end_x = metric->x1 + start_x; // x0 is assumed to be 0
     int glyph_end = metric->x1, glyph_start = 0;
     if (!font_surface && !is_whitespace(codepoint))
-      ren_draw_rect(rs, (RenRect){ start_x + 1, y, font->space_advance - 1, ren_font_group_get_height(fonts) }, color);
+      ren_draw_rect(rs, (RenRect){ start_x / surface_scale + 1, y / surface_scale, font->space_advance - 1, ren_font_group_get_height(fonts) }, color);
     if (!is_whitespace(codepoint) && font_surface && color.a > 0 && end_x >= clip.x && start_x < clip_end_x) {
       uint8_t* source_pixels = font_surface->pixels;
+      const bool subpixel = metric->format == EGlyphFormatSubpixel;
+      const int source_bpp = SDL_GetPixelFormatDetails(font_surface->format)->bytes_per_pixel;
+      drawn++;
       for (int line = metric->y0; line < metric->y1; ++line) {
         int target_y = line - metric->y0 + y - metric->bitmap_top + (fonts[0]->baseline * surface_scale);
         if (target_y < clip.y)
@@ -661,12 +2275,14 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
           start_x += offset;
           glyph_start += offset;
         }
-        
-        const SDL_PixelFormatDetails* surface_format = SDL_GetPixelFormatDetails(surface->format);
-        const SDL_PixelFormatDetails* font_surface_format = SDL_GetPixelFormatDetails(font_surface->format);
 
         uint32_t* destination_pixel = (uint32_t*)&(destination_pixels[surface->pitch * target_y + start_x * surface_format->bytes_per_pixel]);
-        uint8_t* source_pixel = &source_pixels[line * font_surface->pitch + glyph_start * font_surface_format->bytes_per_pixel];
+        uint8_t* source_pixel = &source_pixels[line * font_surface->pitch + glyph_start * source_bpp];
+        if (blendable) {
+          if (glyph_end > glyph_start)
+            blend_glyph_row(destination_pixel, source_pixel, glyph_end - glyph_start, color, surface_format->Amask, subpixel);
+          continue;
+        }
         for (int x = glyph_start; x < glyph_end; ++x) {
           uint32_t destination_color = *destination_pixel;
           // the standard way of doing this would be SDL_GetRGBA, but that introduces a performance regression. needs to be investigated
@@ -677,7 +2293,7 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
             (destination_color & surface_format->Amask) >> surface_format->Ashift};
           SDL_Color src;
 
-          if (metric->format == EGlyphFormatSubpixel) {
+          if (subpixel) {
             src.r = *(source_pixel++);
             src.g = *(source_pixel++);
           } else {
@@ -697,11 +2313,11 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
       }
     }
 
-    float adv = font_get_xadvance(fonts[0], codepoint, metric, pen_x - original_pen_x, tab);
+    float adv = font_get_xadvance(fonts[0], codepoint, metric, pen_x - original_pen_x, tab, tab_size);
 
     if(!last) last = font;
-    else if(font != last || text == end) {
-      double local_pen_x = text == end ? pen_x + adv : pen_x;
+    else if(font != last || glyph_iterator_done(&it)) {
+      double local_pen_x = glyph_iterator_done(&it) ? pen_x + adv : pen_x;
       if (underline)
         ren_draw_rect(rs, (RenRect){last_pen_x, y / surface_scale + last->height - 1, (local_pen_x - last_pen_x) / surface_scale, last->underline_thickness * surface_scale}, color);
       if (strikethrough)
@@ -712,18 +2328,48 @@ double ren_draw_text(RenSurface *rs, RenFont **fonts, const char *text, size_t l
 
     pen_x += adv;
   }
+  if (drawn > 0) SDL_AddAtomicInt(&glyph_stats.drawn, drawn);
   return pen_x / surface_scale;
 }
 
+void ren_get_glyph_stats(RenGlyphStats *stats) {
+  stats->drawn = SDL_GetAtomicInt(&glyph_stats.drawn);
+  stats->misses = SDL_GetAtomicInt(&glyph_stats.misses);
+  stats->rasterized = SDL_GetAtomicInt(&glyph_stats.rasterized);
+}
+
 /******************* Rectangles **********************/
 static inline RenColor blend_pixel(RenColor dst, RenColor src) {
   int ia = 0xff - src.a;
-  dst.r = ((src.r * src.a) + (dst.r * ia)) >> 8;
-  dst.g = ((src.g * src.a) + (dst.g * ia)) >> 8;
-  dst.b = ((src.b * src.a) + (dst.b * ia)) >> 8;
+  dst.r = ((src.r * src.a) + (dst.r * ia) + 127) / 255;
+  dst.g = ((src.g * src.a) + (dst.g * ia) + 127) / 255;
+  dst.b = ((src.b * src.a) + (dst.b * ia) + 127) / 255;
   return dst;
 }
 
+// blends a constant color over an already clipped rectangle of a 32bit surface
+static void blend_rect(SDL_Surface *surface, const SDL_Rect *rect, RenColor color) {
+  const SDL_PixelFormatDetails* fmt = SDL_GetPixelFormatDetails(surface->format);
+  if (is_blendable_format(fmt)) {
+    for (int y = rect->y; y < rect->y + rect->h; y++) {
+      blend_rect_row((uint32_t *) ((uint8_t *) surface->pixels + y * surface->pitch) + rect->x, rect->w, color, fmt->Amask);
+    }
+    return;
+  }
+  for (int y = rect->y; y < rect->y + rect->h; y++) {
+    uint32_t *pixel = (uint32_t *) ((uint8_t *) surface->pixels + y * surface->pitch) + rect->x;
+    for (int x = 0; x < rect->w; x++, pixel++) {
+      RenColor dst = {
+        .r = (*pixel & fmt->Rmask) >> fmt->Rshift,
+        .g = (*pixel & fmt->Gmask) >> fmt->Gshift,
+        .b = (*pixel & fmt->Bmask) >> fmt->Bshift,
+      };
+      dst = blend_pixel(dst, color);
+      *pixel = (*pixel & fmt->Amask) | (uint32_t) dst.r << fmt->Rshift | (uint32_t) dst.g << fmt->Gshift | (uint32_t) dst.b << fmt->Bshift;
+    }
+  }
+}
+
 void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color) {
   if (color.a == 0) { return; }
 
@@ -735,19 +2381,16 @@ void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color) {
                          rect.width * surface_scale,
                          rect.height * surface_scale };
 
+  // the surface clip rect is shared by every thread drawing to the surface,
+  // so we clip against the RenSurface clip ourselves.
+  SDL_Rect clip = surface_clip_rect(rs);
+  if (!SDL_GetRectIntersection(&clip, &dest_rect, &dest_rect)) return;
+
   if (color.a == 0xff) {
     uint32_t translated = SDL_MapSurfaceRGB(surface, color.r, color.g, color.b);
     SDL_FillSurfaceRect(surface, &dest_rect, translated);
   } else {
-    // Seems like SDL doesn't handle clipping as we expect when using
-    // scaled blitting, so we "clip" manually.
-    SDL_Rect clip;
-    SDL_GetSurfaceClipRect(surface, &clip);
-    if (!SDL_GetRectIntersection(&clip, &dest_rect, &dest_rect)) return;
-
-    uint32_t *pixel = (uint32_t *)draw_rect_surface->pixels;
-    *pixel = SDL_MapSurfaceRGBA(draw_rect_surface, color.r, color.g, color.b, color.a);
-    SDL_BlitSurfaceScaled(draw_rect_surface, NULL, surface, &dest_rect, SDL_SCALEMODE_LINEAR);
+    blend_rect(surface, &dest_rect, color);
   }
 }
 
@@ -771,19 +2414,19 @@ static void ren_remove_window(RenWindow *window_renderer) {
 int ren_init(void) {
   FT_Error err;
 
-  draw_rect_surface = SDL_CreateSurface(1, 1, SDL_PIXELFORMAT_RGBA32);
-
-  if (!draw_rect_surface)
-    return -1; // error set by SDL_CreateRGBSurface
-
   if ((err = FT_Init_FreeType(&library)) != 0)
     return SDL_SetError("%s", get_ft_error(err));
 
+  init_blenders();
+
   return 0;
 }
 
 void ren_free(void) {
-  SDL_DestroySurface(draw_rect_surface);
+  prewarm_stop();
+  text_run_cache_drop(NULL);
+  glyph_group_drop(NULL);
+  ren_set_glyph_cache_dir(NULL);
   FT_Done_FreeType(library);
 }
 
@@ -800,9 +2443,25 @@ RenWindow* ren_create(SDL_Window *win) {
   return window_renderer;
 }
 
+RenWindow* ren_create_offscreen(int width, int height, int scale) {
+  RenWindow* window_renderer = SDL_calloc(1, sizeof(RenWindow));
+  if (!window_renderer) return NULL;
+  if (!renwin_init_offscreen(window_renderer, width, height, scale)) {
+    SDL_free(window_renderer);
+    return NULL;
+  }
+  renwin_init_surface(window_renderer);
+  renwin_init_command_buf(window_renderer);
+  renwin_clip_to_surface(window_renderer);
+
+  ren_add_window(window_renderer);
+  return window_renderer;
+}
+
 void ren_destroy(RenWindow* window_renderer) {
   assert(window_renderer);
   ren_remove_window(window_renderer);
+  rencache_free_window(window_renderer);
   renwin_free(window_renderer);
   SDL_free(window_renderer->command_buf);
   window_renderer->command_buf = NULL;
@@ -826,19 +2485,10 @@ void ren_update_rects(RenWindow *window_renderer, RenRect *rects, int count) {
 }
 
 
-void ren_set_clip_rect(RenWindow *window_renderer, RenRect rect) {
-  renwin_set_clip_rect(window_renderer, rect);
-}
-
-
 void ren_get_size(RenWindow *window_renderer, int *x, int *y) {
   RenSurface rs = renwin_get_surface(window_renderer);
-  *x = rs.surface->w;
-  *y = rs.surface->h;
-#ifdef LITE_USE_SDL_RENDERER
-  *x /= rs.scale;
-  *y /= rs.scale;
-#endif
+  *x = rs.surface->w / rs.scale;
+  *y = rs.surface->h / rs.scale;
 }
 
 size_t ren_get_window_list(RenWindow ***window_list_dest) {
@@ -847,6 +2497,7 @@ size_t ren_get_window_list(RenWindow ***window_list_dest) {
 }
 
 RenWindow* ren_find_window(SDL_Window *window) {
+  if (!window) return NULL; // offscreen windows don't receive events
   for (size_t i = 0; i < window_count; ++i) {
     RenWindow* window_renderer = window_list[i];
     if (window_renderer->window == window) {
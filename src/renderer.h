@@ -20,10 +20,28 @@ typedef enum { FONT_STYLE_BOLD = 1, FONT_STYLE_ITALIC = 2, FONT_STYLE_UNDERLINE
 typedef struct { uint8_t b, g, r, a; } RenColor;
 typedef struct { int x, y, width, height; } RenRect;
 typedef struct { double offset; } RenTab;
-typedef struct { SDL_Surface *surface; int scale; } RenSurface;
+/* clip is in points and is owned by the RenSurface, so that several threads can
+** draw to disjoint areas of the same SDL_Surface at once */
+typedef struct { SDL_Surface *surface; int scale; RenRect clip; } RenSurface;
 
 struct RenWindow;
 typedef struct RenWindow RenWindow;
+/* running totals of the work done on glyphs since the renderer started */
+typedef struct {
+  int drawn;      /* glyph bitmaps blended onto a surface */
+  int misses;     /* glyph lookups that had to go through FreeType */
+  int rasterized; /* glyph bitmaps rendered by FreeType */
+} RenGlyphStats;
+
+/* memory used by the glyph cache of a font, or the sum for a font group */
+typedef struct {
+  size_t bytes;           /* tracked memory, compared against the budget */
+  size_t budget;          /* 0 if unlimited */
+  size_t atlas_bytes;     /* pixels of the atlas surfaces */
+  size_t used_bytes;      /* pixels of the atlas surfaces holding glyphs */
+  int surfaces;
+  unsigned int evictions; /* atlas surfaces cleared to stay within the budget */
+} RenGlyphCacheStats;
 
 RenFont* ren_font_load(const char *filename, float size, ERenFontAntialiasing antialiasing, ERenFontHinting hinting, unsigned char style);
 RenFont* ren_font_copy(RenFont* font, float size, ERenFontAntialiasing antialiasing, ERenFontHinting hinting, int style);
@@ -31,24 +49,33 @@ const char* ren_font_get_path(RenFont *font);
 void ren_font_free(RenFont *font);
 int ren_font_group_get_tab_size(RenFont **font);
 int ren_font_group_get_height(RenFont **font);
+int ren_font_group_get_overhang(RenFont **font); /* how far glyphs can be drawn out of the box of their text */
 float ren_font_group_get_size(RenFont **font);
 void ren_font_group_set_size(RenFont **font, float size, int surface_scale);
 #ifdef LITE_USE_SDL_RENDERER
 void update_font_scale(RenWindow *window_renderer, RenFont **fonts);
 #endif
 void ren_font_group_set_tab_size(RenFont **font, int n);
+void ren_font_group_set_cache_budget(RenFont **font, size_t budget);
+void ren_font_group_get_cache_stats(RenFont **font, RenGlyphCacheStats *stats);
+void ren_glyph_cache_tick(void); /* glyphs used since the last tick are kept in the cache */
+void ren_set_glyph_cache_dir(const char *dir); /* fonts loaded afterwards save their glyphs there, NULL disables */
 double ren_font_group_get_width(RenFont **font, const char *text, size_t len, RenTab tab, int *x_offset);
-double ren_draw_text(RenSurface *rs, RenFont **font, const char *text, size_t len, float x, int y, RenColor color, RenTab tab);
+int ren_font_group_prewarm(RenFont **font, const char *text, size_t len);
+void ren_commit_prewarmed_glyphs(void); /* copies the glyphs rasterized in the background into the atlases */
+void ren_font_group_load_glyphs(RenSurface *rs, RenFont **font, const char *text, size_t len, float x, RenTab tab, int tab_size);
+double ren_draw_text(RenSurface *rs, RenFont **font, const char *text, size_t len, float x, int y, RenColor color, RenTab tab, int tab_size);
+void ren_get_glyph_stats(RenGlyphStats *stats);
 
 void ren_draw_rect(RenSurface *rs, RenRect rect, RenColor color);
 
 int ren_init(void);
 void ren_free(void);
 RenWindow* ren_create(SDL_Window *win);
+RenWindow* ren_create_offscreen(int width, int height, int scale); /* size in points */
 void ren_destroy(RenWindow* window_renderer);
 void ren_resize_window(RenWindow *window_renderer);
 void ren_update_rects(RenWindow *window_renderer, RenRect *rects, int count);
-void ren_set_clip_rect(RenWindow *window_renderer, RenRect rect);
 void ren_get_size(RenWindow *window_renderer, int *x, int *y); /* Reports the size in points. */
 size_t ren_get_window_list(RenWindow ***window_list_dest);
 RenWindow* ren_find_window(SDL_Window *window);
@@ -15,6 +15,35 @@ static int query_surface_scale(RenWindow *ren) {
   return w_pixels / w_points;
 }
 
+/* The texture takes the format of the surface, so that dirty rects are
+   uploaded as they are. A format the renderer has no texture for would be
+   converted by SDL on every upload instead, so the window format is only
+   used when the renderer takes it, then those the blending kernels expect. */
+static SDL_PixelFormat query_surface_format(RenWindow *ren) {
+  static const SDL_PixelFormat preferred[] = { SDL_PIXELFORMAT_XRGB8888, SDL_PIXELFORMAT_ARGB8888 };
+  SDL_PixelFormat format = SDL_GetWindowPixelFormat(ren->window);
+  const SDL_PixelFormat *formats = SDL_GetPointerProperty(SDL_GetRendererProperties(ren->renderer),
+                                                          SDL_PROP_RENDERER_TEXTURE_FORMATS_POINTER, NULL);
+  if (!formats) {
+    return format == SDL_PIXELFORMAT_UNKNOWN ? SDL_PIXELFORMAT_BGRA32 : format;
+  }
+  for (int i = -1; i < (int) SDL_arraysize(preferred); i++) {
+    SDL_PixelFormat wanted = i < 0 ? format : preferred[i];
+    for (int j = 0; formats[j] != SDL_PIXELFORMAT_UNKNOWN; j++) {
+      if (formats[j] == wanted && SDL_BYTESPERPIXEL(wanted) == 4) {
+        return wanted;
+      }
+    }
+  }
+  /* any other 32-bit format is still drawn to, only more slowly */
+  for (int j = 0; formats[j] != SDL_PIXELFORMAT_UNKNOWN; j++) {
+    if (!SDL_ISPIXELFORMAT_FOURCC(formats[j]) && SDL_BYTESPERPIXEL(formats[j]) == 4) {
+      return formats[j];
+    }
+  }
+  return SDL_PIXELFORMAT_BGRA32;
+}
+
 static void setup_renderer(RenWindow *ren, int w, int h) {
   /* Note that w and h here should always be in pixels and obtained from
      a call to SDL_GetWindowSizeInPixels(). */
@@ -30,16 +59,32 @@ static void setup_renderer(RenWindow *ren, int w, int h) {
 #endif
 
 
+/* w and h are in points */
+bool renwin_init_offscreen(RenWindow *ren, int w, int h, int scale) {
+  ren->offscreen.surface = SDL_CreateSurface(w * scale, h * scale, SDL_PIXELFORMAT_XRGB8888);
+  if (!ren->offscreen.surface) {
+    return false;
+  }
+  ren->offscreen.scale = scale;
+  return true;
+}
+
+
 void renwin_init_surface(RenWindow *ren) {
   ren->scale_x = ren->scale_y = 1;
+  if (ren->offscreen.surface) {
+    return;
+  }
 #ifdef LITE_USE_SDL_RENDERER
   if (ren->rensurface.surface) {
     SDL_DestroySurface(ren->rensurface.surface);
   }
   int w, h;
   SDL_GetWindowSizeInPixels(ren->window, &w, &h);
-  SDL_PixelFormat format = SDL_GetWindowPixelFormat(ren->window);
-  ren->rensurface.surface = SDL_CreateSurface(w, h, format == SDL_PIXELFORMAT_UNKNOWN ? SDL_PIXELFORMAT_BGRA32 : format);
+  if (!ren->renderer) {
+    ren->renderer = SDL_CreateRenderer(ren->window, NULL);
+  }
+  ren->rensurface.surface = SDL_CreateSurface(w, h, query_surface_format(ren));
   if (!ren->rensurface.surface) {
     fprintf(stderr, "Error creating surface: %s", SDL_GetError());
     exit(1);
@@ -55,37 +100,35 @@ void renwin_init_command_buf(RenWindow *ren) {
 }
 
 
-static RenRect scaled_rect(const RenRect rect, const int scale) {
-  return (RenRect) {rect.x * scale, rect.y * scale, rect.width * scale, rect.height * scale};
-}
-
-
 void renwin_clip_to_surface(RenWindow *ren) {
   SDL_SetSurfaceClipRect(renwin_get_surface(ren).surface, NULL);
 }
 
 
-void renwin_set_clip_rect(RenWindow *ren, RenRect rect) {
-  RenSurface rs = renwin_get_surface(ren);
-  RenRect sr = scaled_rect(rect, rs.scale);
-  SDL_SetSurfaceClipRect(rs.surface, &(SDL_Rect){.x = sr.x, .y = sr.y, .w = sr.width, .h = sr.height});
-}
-
-
 RenSurface renwin_get_surface(RenWindow *ren) {
+  if (ren->offscreen.surface) {
+    RenSurface rs = ren->offscreen;
+    rs.clip = (RenRect) { 0, 0, rs.surface->w / rs.scale, rs.surface->h / rs.scale };
+    return rs;
+  }
 #ifdef LITE_USE_SDL_RENDERER
-  return ren->rensurface;
+  RenSurface rs = ren->rensurface;
 #else
   SDL_Surface *surface = SDL_GetWindowSurface(ren->window);
   if (!surface) {
     fprintf(stderr, "Error getting window surface: %s", SDL_GetError());
     exit(1);
   }
-  return (RenSurface){.surface = surface, .scale = 1};
+  RenSurface rs = {.surface = surface, .scale = 1};
 #endif
+  rs.clip = (RenRect) { 0, 0, rs.surface->w / rs.scale, rs.surface->h / rs.scale };
+  return rs;
 }
 
 void renwin_resize_surface(RenWindow *ren) {
+  if (ren->offscreen.surface) {
+    return;
+  }
 #ifdef LITE_USE_SDL_RENDERER
   int new_w, new_h, new_scale;
   SDL_GetWindowSizeInPixels(ren->window, &new_w, &new_h);
@@ -102,6 +145,9 @@ void renwin_resize_surface(RenWindow *ren) {
 }
 
 void renwin_update_scale(RenWindow *ren) {
+  if (ren->offscreen.surface) {
+    return;
+  }
 #ifndef LITE_USE_SDL_RENDERER
   SDL_Surface *surface = SDL_GetWindowSurface(ren->window);
   int window_w = surface->w, window_h = surface->h;
@@ -112,10 +158,16 @@ void renwin_update_scale(RenWindow *ren) {
 }
 
 void renwin_show_window(RenWindow *ren) {
-  SDL_ShowWindow(ren->window);
+  if (ren->window) {
+    SDL_ShowWindow(ren->window);
+  }
 }
 
 void renwin_update_rects(RenWindow *ren, RenRect *rects, int count) {
+  /* offscreen pixels are already where they are read from */
+  if (ren->offscreen.surface) {
+    return;
+  }
 #ifdef LITE_USE_SDL_RENDERER
   const int scale = ren->rensurface.scale;
   for (int i = 0; i < count; i++) {
@@ -134,6 +186,11 @@ void renwin_update_rects(RenWindow *ren, RenRect *rects, int count) {
 }
 
 void renwin_free(RenWindow *ren) {
+  if (ren->offscreen.surface) {
+    SDL_DestroySurface(ren->offscreen.surface);
+    ren->offscreen.surface = NULL;
+    return;
+  }
 #ifdef LITE_USE_SDL_RENDERER
   SDL_DestroyTexture(ren->texture);
   SDL_DestroyRenderer(ren->renderer);
@@ -1,13 +1,17 @@
 #include <SDL3/SDL.h>
 #include "renderer.h"
 
+typedef struct RenCache RenCache;
+
 struct RenWindow {
-  SDL_Window *window;
+  SDL_Window *window; /* NULL for offscreen windows */
+  RenSurface offscreen; /* drawn to instead of a window, when it has a surface */
   uint8_t *command_buf;
   size_t command_buf_idx;
   size_t command_buf_size;
   float scale_x;
   float scale_y;
+  RenCache *cache;
 #ifdef LITE_USE_SDL_RENDERER
   SDL_Renderer *renderer;
   SDL_Texture *texture;
@@ -16,10 +20,10 @@ struct RenWindow {
 };
 typedef struct RenWindow RenWindow;
 
+bool renwin_init_offscreen(RenWindow *ren, int w, int h, int scale);
 void renwin_init_surface(RenWindow *ren);
 void renwin_init_command_buf(RenWindow *ren);
 void renwin_clip_to_surface(RenWindow *ren);
-void renwin_set_clip_rect(RenWindow *ren, RenRect rect);
 void renwin_resize_surface(RenWindow *ren);
 void renwin_update_scale(RenWindow *ren);
 void renwin_show_window(RenWindow *ren);